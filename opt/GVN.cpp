@@ -0,0 +1,158 @@
+//
+//  GVN.cpp
+//  uscc
+//
+//  Implements dominator-based global value numbering --
+//  if an instruction computes the same expression as one
+//  that dominates it, replace it with the dominating one
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+#include <algorithm>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+bool GVN::Expression::operator<(const Expression& rhs) const
+{
+	if (mOpcode != rhs.mOpcode)
+	{
+		return mOpcode < rhs.mOpcode;
+	}
+	if (mType != rhs.mType)
+	{
+		return mType < rhs.mType;
+	}
+	if (mExtra != rhs.mExtra)
+	{
+		return mExtra < rhs.mExtra;
+	}
+	return mOperands < rhs.mOperands;
+}
+
+// Only computations without side effects whose result depends on nothing
+// but their operands can be numbered (so no loads, calls or allocas)
+bool GVN::isNumberable(Instruction* I)
+{
+	return isa<BinaryOperator>(I) || isa<CastInst>(I) || isa<CmpInst>(I) ||
+		isa<SelectInst>(I) || isa<GetElementPtrInst>(I);
+}
+
+GVN::Expression GVN::makeExpression(Instruction* I)
+{
+	Expression e;
+	e.mOpcode = I->getOpcode();
+	e.mType = I->getType();
+	e.mExtra = I->getRawSubclassOptionalData();
+	for (Value* op : I->operands())
+	{
+		e.mOperands.push_back(op);
+	}
+
+	// Put the operands of commutative ops and compares in one order, so
+	// a + b and b + a (or a < b and b > a) get the same number
+	if (I->isCommutative() && e.mOperands[1] < e.mOperands[0])
+	{
+		std::swap(e.mOperands[0], e.mOperands[1]);
+	}
+	else if (CmpInst* cmp = dyn_cast<CmpInst>(I))
+	{
+		CmpInst::Predicate pred = cmp->getPredicate();
+		if (e.mOperands[1] < e.mOperands[0])
+		{
+			std::swap(e.mOperands[0], e.mOperands[1]);
+			pred = CmpInst::getSwappedPredicate(pred);
+		}
+		e.mExtra = pred;
+	}
+	return e;
+}
+
+void GVN::processNode(DomTreeNode* node)
+{
+	// Expressions first computed in this block, which go out of scope
+	// once its dominator subtree is done
+	std::vector<Expression> scope;
+
+	BasicBlock* block = node->getBlock();
+	BasicBlock::iterator instrIter = block->begin();
+	while (instrIter != block->end())
+	{
+		Instruction* I = instrIter;
+		++instrIter;
+		if (!isNumberable(I))
+		{
+			continue;
+		}
+
+		Expression e = makeExpression(I);
+		auto found = mAvailable.find(e);
+		if (found != mAvailable.end())
+		{
+			I->replaceAllUsesWith(found->second);
+			I->eraseFromParent();
+			++mNumRemoved;
+		}
+		else
+		{
+			mAvailable.insert(std::make_pair(e, I));
+			scope.push_back(e);
+		}
+	}
+
+	for (auto& child : node->getChildren())
+	{
+		processNode(child);
+	}
+
+	for (const Expression& e : scope)
+	{
+		mAvailable.erase(e);
+	}
+}
+
+bool GVN::runOnFunction(Function& F)
+{
+	mNumRemoved = 0;
+	mAvailable.clear();
+
+	DominatorTree& domTree = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+	processNode(domTree.getRootNode());
+
+	if (gOptOptions.stats)
+	{
+		outs() << "GVN: " << F.getName() << ": removed "
+			<< mNumRemoved << " redundant instructions\n";
+	}
+	return mNumRemoved > 0;
+}
+
+void GVN::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// GVN only removes instructions
+	Info.setPreservesCFG();
+	Info.addRequired<DominatorTreeWrapperPass>();
+	Info.addPreserved<DominatorTreeWrapperPass>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::GVN::ID = 0;
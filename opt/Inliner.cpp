@@ -0,0 +1,182 @@
+//
+//  Inliner.cpp
+//  uscc
+//
+//  Implements a bottom-up function inliner with a
+//  size-based cost model
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace
+{
+
+// The call, the return and moving the arguments into place
+const int kCallCost = 3;
+
+} // anonymous namespace
+
+namespace uscc
+{
+namespace opt
+{
+
+// Callee instructions that survive inlining, less what the call costs
+// and what the arguments let us simplify: uses of a constant fold, and
+// an array that is a GEP into one of the caller's allocas can be told
+// apart from the caller's other memory by LICM once it is inlined
+int Inliner::inlineCost(CallInst* call, Function* callee)
+{
+	int cost = 0;
+	for (BasicBlock& block : *callee)
+	{
+		for (Instruction& I : block)
+		{
+			// Allocas move to the caller's entry block
+			if (!isa<AllocaInst>(I))
+			{
+				cost++;
+			}
+		}
+	}
+
+	cost -= kCallCost + static_cast<int>(call->getNumArgOperands());
+	Function::arg_iterator formal = callee->arg_begin();
+	for (unsigned i = 0; i < call->getNumArgOperands(); i++, ++formal)
+	{
+		Value* actual = call->getArgOperand(i);
+		if (isa<Constant>(actual) ||
+			(actual->getType()->isPointerTy() &&
+			 isa<AllocaInst>(GetUnderlyingObject(actual))))
+		{
+			cost -= static_cast<int>(formal->getNumUses());
+		}
+	}
+	return cost;
+}
+
+// Post-order walk of the direct call graph. A callee already on the
+// walk is part of a cycle, so it is not entered again.
+void Inliner::visit(Function* F)
+{
+	mStarted.insert(F);
+	for (BasicBlock& block : *F)
+	{
+		for (Instruction& I : block)
+		{
+			CallInst* call = dyn_cast<CallInst>(&I);
+			if (call == nullptr)
+			{
+				continue;
+			}
+			Function* callee = call->getCalledFunction();
+			if (callee != nullptr && !callee->isDeclaration() &&
+				mStarted.find(callee) == mStarted.end())
+			{
+				visit(callee);
+			}
+		}
+	}
+	mOrder.push_back(F);
+}
+
+// Only callees that are already done are inlined, so a call into a
+// cycle is left alone until the rest of the cycle has been processed
+bool Inliner::inlineCalls(Function* F)
+{
+	std::vector<CallInst*> calls;
+	for (BasicBlock& block : *F)
+	{
+		for (Instruction& I : block)
+		{
+			CallInst* call = dyn_cast<CallInst>(&I);
+			if (call == nullptr)
+			{
+				continue;
+			}
+			Function* callee = call->getCalledFunction();
+			if (callee != nullptr && callee != F && !callee->isVarArg() &&
+				mDone.find(callee) != mDone.end())
+			{
+				calls.push_back(call);
+			}
+		}
+	}
+
+	unsigned numInlined = 0;
+	int threshold = static_cast<int>(gOptOptions.inlineThreshold);
+	for (CallInst* call : calls)
+	{
+		if (inlineCost(call, call->getCalledFunction()) > threshold)
+		{
+			continue;
+		}
+		InlineFunctionInfo info;
+		if (InlineFunction(call, info, false))
+		{
+			numInlined++;
+		}
+	}
+	mDone.insert(F);
+
+	if (gOptOptions.stats)
+	{
+		outs() << "Inline: " << F->getName() << ": inlined "
+			<< numInlined << " calls\n";
+	}
+	return numInlined > 0;
+}
+
+bool Inliner::runOnModule(Module& M)
+{
+	if (gOptOptions.inlineThreshold == 0)
+	{
+		return false;
+	}
+
+	mOrder.clear();
+	mStarted.clear();
+	mDone.clear();
+	for (Function& F : M)
+	{
+		if (!F.isDeclaration() && mStarted.find(&F) == mStarted.end())
+		{
+			visit(&F);
+		}
+	}
+
+	bool changed = false;
+	for (Function* F : mOrder)
+	{
+		changed |= inlineCalls(F);
+	}
+	return changed;
+}
+
+void Inliner::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Inlining changes the CFG of the callers, so nothing is preserved
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::Inliner::ID = 0;
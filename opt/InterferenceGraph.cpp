@@ -0,0 +1,159 @@
+//
+//  InterferenceGraph.cpp
+//  uscc
+//
+//  Implements the interference graph used by the USCC
+//  register allocator
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "InterferenceGraph.h"
+
+using namespace uscc::opt;
+
+void InterferenceGraph::reset(unsigned numIndices)
+{
+	uint64_t bits = static_cast<uint64_t>(numIndices) * numIndices / 2;
+	mMatrix.assign(static_cast<size_t>((bits + 63) / 64), 0);
+
+	// Keep the per-node vectors' capacity around between functions
+	mAdjacency.resize(numIndices);
+	for (std::vector<unsigned>& adj : mAdjacency)
+	{
+		adj.clear();
+	}
+	mDegree.assign(numIndices, 0);
+	mPresent.assign(numIndices, false);
+	mNumNodes = 0;
+	mNumEdges = 0;
+}
+
+void InterferenceGraph::grow(unsigned numIndices)
+{
+	if (numIndices <= mAdjacency.size())
+	{
+		return;
+	}
+
+	// Rows of the triangular matrix are laid out by the larger index,
+	// so new nodes only append bits
+	uint64_t bits = static_cast<uint64_t>(numIndices) * numIndices / 2;
+	mMatrix.resize(static_cast<size_t>((bits + 63) / 64), 0);
+	mAdjacency.resize(numIndices);
+	mDegree.resize(numIndices, 0);
+	mPresent.resize(numIndices, false);
+}
+
+void InterferenceGraph::clear()
+{
+	std::vector<uint64_t>().swap(mMatrix);
+	std::vector<std::vector<unsigned>>().swap(mAdjacency);
+	std::vector<unsigned>().swap(mDegree);
+	std::vector<bool>().swap(mPresent);
+	mNumNodes = 0;
+	mNumEdges = 0;
+}
+
+void InterferenceGraph::addNode(unsigned n)
+{
+	if (!mPresent[n])
+	{
+		mPresent[n] = true;
+		++mNumNodes;
+	}
+}
+
+void InterferenceGraph::addEdge(unsigned a, unsigned b)
+{
+	if (a == b)
+	{
+		return;
+	}
+
+	uint64_t bit = bitIndex(a, b);
+	uint64_t mask = uint64_t(1) << (bit % 64);
+	uint64_t& word = mMatrix[static_cast<size_t>(bit / 64)];
+	if (word & mask)
+	{
+		return;
+	}
+	word |= mask;
+
+	mAdjacency[a].push_back(b);
+	mAdjacency[b].push_back(a);
+	++mDegree[a];
+	++mDegree[b];
+	++mNumEdges;
+}
+
+bool InterferenceGraph::hasEdge(unsigned a, unsigned b) const
+{
+	if (a == b)
+	{
+		return false;
+	}
+
+	uint64_t bit = bitIndex(a, b);
+	return (mMatrix[static_cast<size_t>(bit / 64)] >> (bit % 64)) & 1;
+}
+
+void InterferenceGraph::eraseNode(unsigned n)
+{
+	for (unsigned m : mAdjacency[n])
+	{
+		uint64_t bit = bitIndex(n, m);
+		mMatrix[static_cast<size_t>(bit / 64)] &= ~(uint64_t(1) << (bit % 64));
+
+		std::vector<unsigned>& adj = mAdjacency[m];
+		for (size_t i = 0; i < adj.size(); ++i)
+		{
+			if (adj[i] == n)
+			{
+				adj[i] = adj.back();
+				adj.pop_back();
+				break;
+			}
+		}
+		// Each side only counts the other while it is present
+		if (mPresent[n])
+		{
+			--mDegree[m];
+		}
+		if (mPresent[m])
+		{
+			--mDegree[n];
+		}
+		--mNumEdges;
+	}
+	mAdjacency[n].clear();
+
+	if (mPresent[n])
+	{
+		mPresent[n] = false;
+		--mNumNodes;
+	}
+}
+
+void InterferenceGraph::removeNode(unsigned n)
+{
+	if (!mPresent[n])
+	{
+		return;
+	}
+
+	mPresent[n] = false;
+	--mNumNodes;
+	for (unsigned m : mAdjacency[n])
+	{
+		if (mPresent[m])
+		{
+			--mDegree[m];
+		}
+	}
+}
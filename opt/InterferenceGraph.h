@@ -0,0 +1,135 @@
+//
+//  InterferenceGraph.h
+//  uscc
+//
+//  Declares the interference graph used by the USCC
+//  register allocator
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace uscc
+{
+namespace opt
+{
+
+// Undirected interference graph over dense node indices
+// (for the allocator, TargetRegisterInfo::virtReg2Index).
+//
+// Edges are stored twice: a triangular bit-matrix answers
+// "do a and b interfere" in O(1), and packed adjacency vectors
+// are used to walk the neighbors of a node.
+//
+// Removing a node only hides it -- its adjacency vector is left
+// intact so the select phase can still see every original
+// neighbor, and the degree of each remaining neighbor drops by one.
+class InterferenceGraph
+{
+public:
+	// Drops all nodes and edges and sizes the graph for indices [0, numIndices)
+	void reset(unsigned numIndices);
+
+	// Extends the index space to [0, numIndices), keeping nodes and edges
+	void grow(unsigned numIndices);
+
+	// Releases all memory held by the graph
+	void clear();
+
+	// Adds a node to the graph (no-op if already present)
+	void addNode(unsigned n);
+
+	// Adds an edge between two present nodes (no-op if a == b or already present)
+	void addEdge(unsigned a, unsigned b);
+
+	// Returns true if a and b interfere
+	bool hasEdge(unsigned a, unsigned b) const;
+
+	// Hides a node from the graph, decrementing the degree of its neighbors
+	void removeNode(unsigned n);
+
+	// Deletes a node and all of its edges for good (unlike removeNode,
+	// the neighbors forget about it too)
+	void eraseNode(unsigned n);
+
+	// Returns true if the node was added and has not been removed
+	bool hasNode(unsigned n) const
+	{
+		return n < mPresent.size() && mPresent[n];
+	}
+
+	// Number of neighbors that are still in the graph
+	unsigned degree(unsigned n) const
+	{
+		return mDegree[n];
+	}
+
+	// All neighbors the node had when the graph was built,
+	// including ones that have since been removed
+	const std::vector<unsigned>& neighbors(unsigned n) const
+	{
+		return mAdjacency[n];
+	}
+
+	// Number of nodes still in the graph
+	unsigned numNodes() const
+	{
+		return mNumNodes;
+	}
+
+	// Number of distinct edges added to the graph
+	unsigned numEdges() const
+	{
+		return mNumEdges;
+	}
+
+	bool empty() const
+	{
+		return mNumNodes == 0;
+	}
+
+	// Size of the index space the graph was reset to
+	unsigned numIndices() const
+	{
+		return static_cast<unsigned>(mAdjacency.size());
+	}
+private:
+	// Position of the (a, b) bit in the lower-triangular matrix (a > b)
+	static uint64_t bitIndex(unsigned a, unsigned b)
+	{
+		if (a < b)
+		{
+			unsigned t = a;
+			a = b;
+			b = t;
+		}
+		return static_cast<uint64_t>(a) * (a - 1) / 2 + b;
+	}
+
+	// Lower-triangular bit-matrix, 64 edges per word
+	std::vector<uint64_t> mMatrix;
+
+	// Neighbors of each node
+	std::vector<std::vector<unsigned>> mAdjacency;
+
+	// Current degree of each node
+	std::vector<unsigned> mDegree;
+
+	// Whether each node is currently in the graph
+	std::vector<bool> mPresent;
+
+	unsigned mNumNodes = 0;
+	unsigned mNumEdges = 0;
+};
+
+} // opt
+} // uscc
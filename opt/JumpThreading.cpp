@@ -0,0 +1,258 @@
+//
+//  JumpThreading.cpp
+//  uscc
+//
+//  Implements jump threading -- a predecessor that
+//  decides a block's branch through a PHI jumps straight
+//  to the successor that branch would take
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+#include <algorithm>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// The block must be PHIs, then casts/compares/binops computing the
+// condition, then the branch, and nothing in it may be used elsewhere.
+// That is the and.end/lor.end shape:
+//     %phi = phi i1 [ false, %lhs ], [ %tobool, %and.rhs ]
+//     %zext = zext i1 %phi to i32
+//     %cond = icmp ne i32 %zext, 0
+//     br i1 %cond, label %if.then, label %if.end
+bool JumpThreading::isThreadable(BasicBlock* block)
+{
+	BranchInst* br = dyn_cast<BranchInst>(block->getTerminator());
+	if (br == nullptr || !br->isConditional() ||
+		br->getSuccessor(0) == br->getSuccessor(1))
+	{
+		return false;
+	}
+	Instruction* cond = dyn_cast<Instruction>(br->getCondition());
+	if (cond == nullptr || cond->getParent() != block)
+	{
+		return false;
+	}
+
+	for (Instruction& I : *block)
+	{
+		if (&I == br)
+		{
+			continue;
+		}
+		if (!isa<PHINode>(I) && !isa<CastInst>(I) && !isa<CmpInst>(I) &&
+			!isa<BinaryOperator>(I))
+		{
+			return false;
+		}
+		for (User* user : I.users())
+		{
+			Instruction* userInstr = cast<Instruction>(user);
+			if (userInstr->getParent() != block || isa<PHINode>(userInstr))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Folds the block's instructions with its PHIs set to the values
+// coming from pred, and returns where the branch goes (or null)
+BasicBlock* JumpThreading::evaluate(BasicBlock* block, BasicBlock* pred)
+{
+	std::map<Value*, Constant*> values;
+	for (Instruction& I : *block)
+	{
+		if (PHINode* phi = dyn_cast<PHINode>(&I))
+		{
+			Constant* C = dyn_cast<Constant>(phi->getIncomingValueForBlock(pred));
+			if (C != nullptr)
+			{
+				values[phi] = C;
+			}
+			continue;
+		}
+		if (isa<TerminatorInst>(I))
+		{
+			break;
+		}
+
+		std::vector<Constant*> operands;
+		for (Value* operand : I.operands())
+		{
+			Constant* C = dyn_cast<Constant>(operand);
+			if (C == nullptr)
+			{
+				auto iter = values.find(operand);
+				C = iter != values.end() ? iter->second : nullptr;
+			}
+			if (C == nullptr)
+			{
+				break;
+			}
+			operands.push_back(C);
+		}
+		if (operands.size() != I.getNumOperands())
+		{
+			continue;
+		}
+
+		Constant* folded = nullptr;
+		if (CmpInst* cmp = dyn_cast<CmpInst>(&I))
+		{
+			folded = ConstantFoldCompareInstOperands(cmp->getPredicate(), operands[0], operands[1]);
+		}
+		else
+		{
+			folded = ConstantFoldInstOperands(I.getOpcode(), I.getType(), operands);
+		}
+		if (folded != nullptr)
+		{
+			values[&I] = folded;
+		}
+	}
+
+	BranchInst* br = cast<BranchInst>(block->getTerminator());
+	auto iter = values.find(br->getCondition());
+	ConstantInt* cond = iter != values.end() ? dyn_cast<ConstantInt>(iter->second) : nullptr;
+	if (cond == nullptr)
+	{
+		return nullptr;
+	}
+	return br->getSuccessor(cond->isZero() ? 1 : 0);
+}
+
+// Retargets every predecessor whose PHI values decide the branch. The
+// successor's PHIs take the value they had through block, which can't
+// be defined in block since nothing there is used outside it.
+bool JumpThreading::threadBlock(BasicBlock* block)
+{
+	if (!isThreadable(block))
+	{
+		return false;
+	}
+
+	std::vector<BasicBlock*> preds;
+	for (auto iter = pred_begin(block); iter != pred_end(block); ++iter)
+	{
+		BasicBlock* pred = *iter;
+		if (std::find(preds.begin(), preds.end(), pred) == preds.end())
+		{
+			preds.push_back(pred);
+		}
+	}
+
+	// Evaluate everything first, since removing a predecessor can fold
+	// away the PHIs that are being evaluated
+	std::vector<std::pair<BasicBlock*, BasicBlock*>> edges;
+	for (BasicBlock* pred : preds)
+	{
+		TerminatorInst* term = pred->getTerminator();
+		if (pred == block || !isa<BranchInst>(term))
+		{
+			continue;
+		}
+		BasicBlock* dest = evaluate(block, pred);
+		if (dest == nullptr || std::find(succ_begin(pred), succ_end(pred), dest) != succ_end(pred))
+		{
+			continue;
+		}
+		// A conditional branch to block on both sides stays as it is
+		unsigned toBlock = 0;
+		for (unsigned i = 0; i < term->getNumSuccessors(); i++)
+		{
+			toBlock += term->getSuccessor(i) == block ? 1 : 0;
+		}
+		if (toBlock == 1)
+		{
+			edges.push_back(std::make_pair(pred, dest));
+		}
+	}
+
+	for (auto& edge : edges)
+	{
+		BasicBlock* pred = edge.first;
+		BasicBlock* dest = edge.second;
+		for (BasicBlock::iterator iter = dest->begin(); isa<PHINode>(iter); ++iter)
+		{
+			PHINode* phi = cast<PHINode>(iter);
+			phi->addIncoming(phi->getIncomingValueForBlock(block), pred);
+		}
+		block->removePredecessor(pred);
+		pred->getTerminator()->replaceUsesOfWith(block, dest);
+		++mNumThreaded;
+	}
+	return !edges.empty();
+}
+
+bool JumpThreading::runOnFunction(Function& F)
+{
+	mNumThreaded = 0;
+
+	// Threading the entry edge of a loop would give it a second entry
+	LoopInfo& loopInfo = getAnalysis<LoopInfo>();
+	std::vector<BasicBlock*> headers;
+	for (BasicBlock& block : F)
+	{
+		if (loopInfo.isLoopHeader(&block))
+		{
+			headers.push_back(&block);
+		}
+	}
+
+	// Nested && and || thread from the inside out, so repeat until
+	// nothing changes
+	bool changed = false;
+	bool iterChanged = true;
+	while (iterChanged)
+	{
+		iterChanged = false;
+		for (BasicBlock& block : F)
+		{
+			if (std::find(headers.begin(), headers.end(), &block) == headers.end())
+			{
+				iterChanged |= threadBlock(&block);
+			}
+		}
+		changed |= iterChanged;
+	}
+
+	if (gOptOptions.stats)
+	{
+		outs() << "JumpThreading: " << F.getName() << ": threaded "
+			<< mNumThreaded << " edges\n";
+	}
+	return changed;
+}
+
+void JumpThreading::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Changes the CFG, so nothing is preserved
+	Info.addRequired<LoopInfo>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::JumpThreading::ID = 0;
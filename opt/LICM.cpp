@@ -16,13 +16,53 @@
 #pragma clang diagnostic ignored "-Wconversion"
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Dominators.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/Analysis/CaptureTracking.h>
 #include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
 #pragma clang diagnostic pop
+#include <set>
 
 using namespace llvm;
 
+namespace
+{
+
+// Rewrites the loads and stores of a promoted address to SSA values,
+// and stores the value live out of the loop back at each exit
+class StorePromoter : public LoadAndStorePromoter
+{
+public:
+	StorePromoter(const SmallVectorImpl<Instruction*>& insts, SSAUpdater& ssa,
+				  Value* ptr, const SmallVectorImpl<BasicBlock*>& exits)
+	: LoadAndStorePromoter(insts, ssa)
+	, mSSA(ssa)
+	, mPtr(ptr)
+	, mExits(exits)
+	{
+	}
+
+	virtual void doExtraRewritesBeforeFinalDeletion() const override
+	{
+		for (BasicBlock* exit : mExits)
+		{
+			Value* liveOut = mSSA.GetValueInMiddleOfBlock(exit);
+			new StoreInst(liveOut, mPtr, exit->getFirstInsertionPt());
+		}
+	}
+
+private:
+	SSAUpdater& mSSA;
+	Value* mPtr;
+	const SmallVectorImpl<BasicBlock*>& mExits;
+};
+
+} // anonymous namespace
+
 namespace uscc
 {
 namespace opt
@@ -31,9 +71,12 @@ namespace opt
 
 bool LICM::isSafeToHoistInstr(llvm::Instruction * ins) const
 {
-    return (mCurrLoop->hasLoopInvariantOperands(ins) &&
-        isSafeToSpeculativelyExecute(ins) &&
-     (isa<BinaryOperator>(ins) || isa<CastInst>(ins) || isa<SelectInst>(ins) 
+    if (!mCurrLoop->hasLoopInvariantOperands(ins))
+        return false;
+    if (LoadInst* load = dyn_cast<LoadInst>(ins))
+        return isSafeToHoistLoad(load);
+    return (isSafeToSpeculativelyExecute(ins) &&
+     (isa<BinaryOperator>(ins) || isa<CastInst>(ins) || isa<SelectInst>(ins)
         || isa<GetElementPtrInst>(ins) || isa<CmpInst>(ins)));
 }
 
@@ -41,6 +84,8 @@ void LICM::hoistInstr(llvm::Instruction * ins)
 {
     auto preheader = mCurrLoop->getLoopPreheader();
     ins->moveBefore(preheader->getTerminator());
+    if (isa<LoadInst>(ins))
+        ++mNumHoistedLoads;
     mChanged = true;
 }
 
@@ -63,6 +108,282 @@ void LICM::hoistPreOrder(llvm::DomTreeNode * node)
         hoistPreOrder(c);
 }
 
+// USC has no pointers: memory is a stack array, a global or an array
+// argument, so the alias rules below can tell accesses apart by object
+bool LICM::isLocalObject(llvm::Value* obj)
+{
+    return isa<AllocaInst>(obj) || isa<GlobalVariable>(obj) || isa<Argument>(obj);
+}
+
+// Does the first test of the loop always go into the body? Only when the
+// header compares constants, after taking the header PHIs' values from
+// the preheader (while (i < 10) with i = 0).
+bool LICM::entersBody() const
+{
+    BasicBlock* header = mCurrLoop->getHeader();
+    BasicBlock* preheader = mCurrLoop->getLoopPreheader();
+    BranchInst* br = dyn_cast<BranchInst>(header->getTerminator());
+    if (br == nullptr || preheader == nullptr)
+        return false;
+    if (!br->isConditional())
+        return mCurrLoop->contains(br->getSuccessor(0));
+
+    ICmpInst* cmp = dyn_cast<ICmpInst>(br->getCondition());
+    if (cmp == nullptr)
+        return false;
+    Constant* operands[2];
+    for (unsigned i = 0; i < 2; i++)
+    {
+        Value* operand = cmp->getOperand(i);
+        PHINode* phi = dyn_cast<PHINode>(operand);
+        if (phi != nullptr && phi->getParent() == header)
+            operand = phi->getIncomingValueForBlock(preheader);
+        operands[i] = dyn_cast<Constant>(operand);
+        if (operands[i] == nullptr)
+            return false;
+    }
+    ConstantInt* cond = dyn_cast<ConstantInt>(
+        ConstantExpr::getICmp(cmp->getPredicate(), operands[0], operands[1]));
+    if (cond == nullptr)
+        return false;
+    return mCurrLoop->contains(br->getSuccessor(cond->isZero() ? 1 : 0));
+}
+
+// USC arrays have no bounds checks, so an index is only known to be valid
+// where the program actually uses it: a[k] under if (k < len) may be out
+// of bounds otherwise, and so may any access in a loop that runs zero
+// times. Memory accesses therefore only move to the preheader from blocks
+// that run whenever the preheader does. The header always does. Another
+// block does if the loop always enters its body and the block dominates
+// the latches and every exit other than the header's.
+bool LICM::isGuaranteedToExecute(llvm::BasicBlock* b) const
+{
+    BasicBlock* header = mCurrLoop->getHeader();
+    if (b == header)
+        return true;
+    if (!mEntersBody)
+        return false;
+
+    SmallVector<BasicBlock*, 4> exiting;
+    mCurrLoop->getExitingBlocks(exiting);
+    for (BasicBlock* e : exiting)
+    {
+        if (e != header && !mDomTree->dominates(b, e))
+            return false;
+    }
+    for (auto iter = pred_begin(header); iter != pred_end(header); ++iter)
+    {
+        if (mCurrLoop->contains(*iter) && !mDomTree->dominates(b, *iter))
+            return false;
+    }
+    return true;
+}
+
+bool LICM::isSafeToHoistLoad(llvm::LoadInst* load) const
+{
+    if (!load->isSimple() || !mCurrLoop->getLoopPreheader())
+        return false;
+    if (!isLocalObject(GetUnderlyingObject(load->getPointerOperand())))
+        return false;
+    if (!isGuaranteedToExecute(load->getParent()))
+        return false;
+    return !isClobberedInLoop(load->getPointerOperand(), load->getType());
+}
+
+// A simple alias analysis for the memory USC can address:
+//  * char and int arrays are never accessed as each other
+//  * distinct allocas and globals never overlap
+//  * an argument cannot point into this function's allocas
+//  * a noalias argument only overlaps itself
+bool LICM::mayAlias(llvm::Value* a, llvm::Type* aType,
+                    llvm::Value* b, llvm::Type* bType)
+{
+    if (a == b)
+        return true;
+    if (aType != nullptr && bType != nullptr && aType != bType)
+        return false;
+
+    Value* objA = GetUnderlyingObject(a);
+    Value* objB = GetUnderlyingObject(b);
+    if (objA == objB)
+        return true;
+
+    bool identifiedA = isa<AllocaInst>(objA) || isa<GlobalVariable>(objA);
+    bool identifiedB = isa<AllocaInst>(objB) || isa<GlobalVariable>(objB);
+    if (identifiedA && identifiedB)
+        return false;
+    if ((isa<AllocaInst>(objA) && isa<Argument>(objB)) ||
+        (isa<Argument>(objA) && isa<AllocaInst>(objB)))
+        return false;
+
+    Argument* argA = dyn_cast<Argument>(objA);
+    Argument* argB = dyn_cast<Argument>(objB);
+    if ((argA != nullptr && argA->hasNoAliasAttr()) ||
+        (argB != nullptr && argB->hasNoAliasAttr()))
+        return false;
+    return true;
+}
+
+// Does anything in the loop possibly write the memory at ptr? Calls can
+// only reach allocas whose address escapes.
+bool LICM::isClobberedInLoop(llvm::Value* ptr, llvm::Type* type) const
+{
+    Value* obj = GetUnderlyingObject(ptr);
+    bool privateAlloca = isa<AllocaInst>(obj) &&
+        !PointerMayBeCaptured(obj, true, true);
+
+    for (Instruction* write : mLoopWrites)
+    {
+        if (StoreInst* store = dyn_cast<StoreInst>(write))
+        {
+            if (mayAlias(ptr, type, store->getPointerOperand(),
+                         store->getValueOperand()->getType()))
+                return true;
+        }
+        else if (MemIntrinsic* mem = dyn_cast<MemIntrinsic>(write))
+        {
+            if (mayAlias(ptr, nullptr, mem->getDest(), nullptr))
+                return true;
+        }
+        else if (!privateAlloca)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LICM::collectLoopWrites()
+{
+    mLoopWrites.clear();
+    for (BasicBlock* b : mCurrLoop->getBlocks())
+    {
+        for (auto iter = b->begin(); iter != b->end(); ++iter)
+        {
+            if (iter->mayWriteToMemory())
+                mLoopWrites.push_back(&*iter);
+        }
+    }
+}
+
+// An invariant address can live in a register for the whole loop if every
+// access in the loop that could touch it goes through exactly that address
+bool LICM::canPromote(llvm::Value* ptr, llvm::Type* type,
+                      llvm::SmallVectorImpl<llvm::Instruction*>& uses) const
+{
+    Value* obj = GetUnderlyingObject(ptr);
+    if (!isLocalObject(obj))
+        return false;
+    bool privateAlloca = isa<AllocaInst>(obj) &&
+        !PointerMayBeCaptured(obj, true, true);
+
+    for (BasicBlock* b : mCurrLoop->getBlocks())
+    {
+        for (auto iter = b->begin(); iter != b->end(); ++iter)
+        {
+            Instruction* ins = &*iter;
+            Value* otherPtr = nullptr;
+            Type* otherType = nullptr;
+            bool simple = true;
+            if (LoadInst* load = dyn_cast<LoadInst>(ins))
+            {
+                otherPtr = load->getPointerOperand();
+                otherType = load->getType();
+                simple = load->isSimple();
+            }
+            else if (StoreInst* store = dyn_cast<StoreInst>(ins))
+            {
+                otherPtr = store->getPointerOperand();
+                otherType = store->getValueOperand()->getType();
+                simple = store->isSimple();
+            }
+            else if (MemIntrinsic* mem = dyn_cast<MemIntrinsic>(ins))
+            {
+                if (mayAlias(ptr, nullptr, mem->getDest(), nullptr))
+                    return false;
+                if (MemTransferInst* transfer = dyn_cast<MemTransferInst>(mem))
+                {
+                    if (mayAlias(ptr, nullptr, transfer->getSource(), nullptr))
+                        return false;
+                }
+                continue;
+            }
+            else
+            {
+                // Calls may read or write anything that escapes
+                if ((ins->mayReadFromMemory() || ins->mayWriteToMemory()) &&
+                    !privateAlloca)
+                    return false;
+                continue;
+            }
+
+            if (otherPtr == ptr)
+            {
+                if (!simple || otherType != type)
+                    return false;
+                uses.push_back(ins);
+            }
+            else if (mayAlias(ptr, type, otherPtr, otherType))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void LICM::promoteStores()
+{
+    BasicBlock* preheader = mCurrLoop->getLoopPreheader();
+    if (!preheader || !mCurrLoop->hasDedicatedExits())
+        return;
+
+    // Each invariant address stored to in the loop is a candidate
+    std::vector<StoreInst*> candidates;
+    std::set<Value*> seen;
+    for (Instruction* write : mLoopWrites)
+    {
+        StoreInst* store = dyn_cast<StoreInst>(write);
+        if (store != nullptr && store->isSimple() &&
+            mCurrLoop->isLoopInvariant(store->getPointerOperand()) &&
+            seen.insert(store->getPointerOperand()).second)
+            candidates.push_back(store);
+    }
+
+    SmallVector<BasicBlock*, 4> exits;
+    mCurrLoop->getExitBlocks(exits);
+    for (StoreInst* store : candidates)
+    {
+        Value* ptr = store->getPointerOperand();
+        SmallVector<Instruction*, 8> uses;
+        if (!canPromote(ptr, store->getValueOperand()->getType(), uses))
+            continue;
+
+        // The preheader load and the exit stores touch ptr even when the
+        // loop runs zero times or skips the store, so some store must run
+        // before the loop can be left (see isGuaranteedToExecute)
+        bool guaranteed = false;
+        for (Instruction* use : uses)
+        {
+            if (isa<StoreInst>(use) && isGuaranteedToExecute(use->getParent()))
+                guaranteed = true;
+        }
+        if (!guaranteed)
+            continue;
+
+        SmallVector<PHINode*, 16> newPHIs;
+        SSAUpdater ssa(&newPHIs);
+        StorePromoter promoter(uses, ssa, ptr, exits);
+        LoadInst* initial = new LoadInst(ptr, ptr->getName() + ".promoted",
+                                         preheader->getTerminator());
+        ssa.AddAvailableValue(preheader, initial);
+        promoter.run(uses);
+
+        ++mNumPromoted;
+        mChanged = true;
+    }
+}
+
 bool LICM::runOnLoop(llvm::Loop *L, llvm::LPPassManager &LPM)
 {
 	mChanged = false;
@@ -74,8 +395,28 @@ bool LICM::runOnLoop(llvm::Loop *L, llvm::LPPassManager &LPM)
     mLoopInfo = &getAnalysis<LoopInfo>();
     // Grab the dominator tree
     mDomTree = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    mNumHoistedLoads = 0;
+    mNumPromoted = 0;
+    mEntersBody = entersBody();
 
+    // Hoist first so store addresses become invariant, promote, and hoist
+    // again now that the promoted stores no longer block loads
+    collectLoopWrites();
     hoistPreOrder(mDomTree->getNode(L->getHeader()));
+    promoteStores();
+    if (mNumPromoted > 0)
+    {
+        collectLoopWrites();
+        hoistPreOrder(mDomTree->getNode(L->getHeader()));
+    }
+
+    if (gOptOptions.stats)
+    {
+        outs() << "LICM: " << L->getHeader()->getParent()->getName()
+            << ": loop " << L->getHeader()->getName() << ": hoisted "
+            << mNumHoistedLoads << " loads, promoted " << mNumPromoted
+            << " stores\n";
+    }
 
 	return mChanged;
 }
@@ -85,8 +426,6 @@ void LICM::getAnalysisUsage(AnalysisUsage &Info) const
 	// PA6: Implement
     // LICM does not modify the CFG 
     Info.setPreservesCFG();
-    // Execute after dead blocks have been removed 
-    Info.addRequired<DeadBlocks>();
     // Use the built-in Dominator tree and loop info passes 
     Info.addRequired<DominatorTreeWrapperPass>(); 
     Info.addRequired<LoopInfo>();
@@ -0,0 +1,253 @@
+//
+//  LoopIdiom.cpp
+//  uscc
+//
+//  Implements loop idiom recognition -- loops that fill
+//  or copy arrays become llvm.memset/llvm.memcpy calls
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// A char store can fill with any invariant value, a wider store only
+// with a constant whose bytes are all the same (0 and -1 mostly)
+Value* LoopIdiom::memsetValue(StoreInst* store)
+{
+	Value* value = store->getValueOperand();
+	IntegerType* type = dyn_cast<IntegerType>(value->getType());
+	if (type == nullptr)
+	{
+		return nullptr;
+	}
+	if (type->getBitWidth() == 8)
+	{
+		return value;
+	}
+
+	ConstantInt* C = dyn_cast<ConstantInt>(value);
+	if (C == nullptr || type->getBitWidth() % 8 != 0 || type->getBitWidth() > 64)
+	{
+		return nullptr;
+	}
+	uint64_t bits = C->getZExtValue();
+	uint64_t byte = bits & 0xff;
+	for (unsigned shift = 8; shift < type->getBitWidth(); shift += 8)
+	{
+		if (((bits >> shift) & 0xff) != byte)
+		{
+			return nullptr;
+		}
+	}
+	return ConstantInt::get(Type::getInt8Ty(store->getContext()), byte);
+}
+
+// The loop must be
+//     while (i < n) { a[i] = x; ++i; }    or
+//     while (i < n) { a[i] = b[i]; ++i; }
+// (or i <= n). It is replaced by one call in the preheader, and uses of
+// i after the loop get its final value.
+bool LoopIdiom::replaceLoop(Loop* L, const LoopUnroll::CountedLoop& info)
+{
+	BasicBlock* header = L->getHeader();
+	BasicBlock* preheader = L->getLoopPreheader();
+	BasicBlock* body = info.mBody;
+	if (!LoopUnroll::isSimpleCountedLoop(L, info))
+	{
+		return false;
+	}
+
+	// Besides the increment and the branch, the body is the GEPs, an
+	// optional load and the store
+	Value* increment = info.mIndVar->getIncomingValueForBlock(body);
+	StoreInst* store = nullptr;
+	LoadInst* load = nullptr;
+	for (Instruction& I : *body)
+	{
+		if (&I == increment || isa<TerminatorInst>(I))
+		{
+			continue;
+		}
+		if (GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(&I))
+		{
+			if (gep->getNumIndices() != 1 || gep->getOperand(1) != info.mIndVar ||
+				!L->isLoopInvariant(gep->getPointerOperand()) || !gep->hasOneUse())
+			{
+				return false;
+			}
+		}
+		else if (isa<LoadInst>(I) && load == nullptr)
+		{
+			load = cast<LoadInst>(&I);
+		}
+		else if (isa<StoreInst>(I) && store == nullptr)
+		{
+			store = cast<StoreInst>(&I);
+		}
+		else
+		{
+			return false;
+		}
+	}
+	if (store == nullptr || !store->isSimple() || !increment->hasOneUse())
+	{
+		return false;
+	}
+	GetElementPtrInst* dest = dyn_cast<GetElementPtrInst>(store->getPointerOperand());
+	if (dest == nullptr || dest->getParent() != body)
+	{
+		return false;
+	}
+
+	GetElementPtrInst* src = nullptr;
+	Value* fill = nullptr;
+	if (load != nullptr)
+	{
+		src = dyn_cast<GetElementPtrInst>(load->getPointerOperand());
+		if (!load->isSimple() || store->getValueOperand() != load ||
+			src == nullptr || src->getParent() != body)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		fill = memsetValue(store);
+		if (fill == nullptr || !L->isLoopInvariant(fill))
+		{
+			return false;
+		}
+	}
+
+	// Element count: n - i (plus one for <=), or 0 if the loop never runs
+	Type* elementType = store->getValueOperand()->getType();
+	uint64_t elementSize = elementType->getPrimitiveSizeInBits() / 8;
+	IRBuilder<> builder(preheader->getTerminator());
+	Type* i64 = builder.getInt64Ty();
+	Value* start = builder.CreateSExt(info.mStart, i64);
+	Value* end = builder.CreateSExt(info.mBound, i64);
+	if (info.mPred == CmpInst::ICMP_SLE)
+	{
+		end = builder.CreateAdd(end, builder.getInt64(1));
+	}
+	Value* runs = builder.CreateICmpSLT(start, end);
+	Value* count = builder.CreateSelect(runs, builder.CreateSub(end, start), builder.getInt64(0));
+	Value* size = builder.CreateMul(count, builder.getInt64(elementSize), "idiom.size");
+
+	Value* destAddr = builder.CreateGEP(dest->getPointerOperand(), info.mStart);
+	unsigned align = static_cast<unsigned>(elementSize);
+	if (fill != nullptr)
+	{
+		builder.CreateMemSet(destAddr, fill, size, align);
+		++mNumMemset;
+	}
+	else
+	{
+		// Two array arguments can be the same array
+		Value* srcAddr = builder.CreateGEP(src->getPointerOperand(), info.mStart);
+		if (LICM::mayAlias(dest->getPointerOperand(), elementType,
+						   src->getPointerOperand(), elementType))
+		{
+			builder.CreateMemMove(destAddr, srcAddr, size, align);
+		}
+		else
+		{
+			builder.CreateMemCpy(destAddr, srcAddr, size, align);
+		}
+		++mNumMemcpy;
+	}
+
+	// Only i can be used after the loop; it ends at n (n + 1 for <=)
+	// unless the loop never ran
+	Value* last = builder.CreateTrunc(builder.CreateSelect(runs, end, start), info.mIndVar->getType());
+	std::vector<Use*> outside;
+	for (Use& U : info.mIndVar->uses())
+	{
+		if (!L->contains(cast<Instruction>(U.getUser())->getParent()))
+		{
+			outside.push_back(&U);
+		}
+	}
+	for (Use* U : outside)
+	{
+		U->set(last);
+	}
+	for (BasicBlock::iterator iter = info.mExit->begin(); isa<PHINode>(iter); ++iter)
+	{
+		PHINode* phi = cast<PHINode>(iter);
+		int index = phi->getBasicBlockIndex(header);
+		if (index >= 0)
+		{
+			phi->setIncomingBlock(index, preheader);
+		}
+	}
+
+	preheader->getTerminator()->replaceUsesOfWith(header, info.mExit);
+	std::vector<BasicBlock*> blocks(L->getBlocks().begin(), L->getBlocks().end());
+	for (BasicBlock* block : blocks)
+	{
+		block->dropAllReferences();
+	}
+	for (BasicBlock* block : blocks)
+	{
+		block->eraseFromParent();
+	}
+	return true;
+}
+
+bool LoopIdiom::runOnFunction(Function& F)
+{
+	mNumMemset = 0;
+	mNumMemcpy = 0;
+
+	LoopInfo& loopInfo = getAnalysis<LoopInfo>();
+	std::vector<Loop*> innermost;
+	collectInnermostLoops(loopInfo, innermost);
+
+	for (Loop* L : innermost)
+	{
+		LoopUnroll::CountedLoop info;
+		if (LoopUnroll::analyzeLoop(L, info))
+		{
+			replaceLoop(L, info);
+		}
+	}
+
+	if (gOptOptions.stats)
+	{
+		outs() << "LoopIdiom: " << F.getName() << ": " << mNumMemset
+			<< " memset, " << mNumMemcpy << " memcpy\n";
+	}
+	return mNumMemset + mNumMemcpy > 0;
+}
+
+void LoopIdiom::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Deletes loops, so nothing is preserved
+	Info.addRequired<LoopInfo>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::LoopIdiom::ID = 0;
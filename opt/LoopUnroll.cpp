@@ -0,0 +1,564 @@
+//
+//  LoopUnroll.cpp
+//  uscc
+//
+//  Implements unrolling of counted while loops --
+//  small constant trip counts are unrolled completely,
+//  others partially with the original loop as remainder
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace
+{
+
+// Size limits, in instructions, of the unrolled loop
+const int64_t kFullUnrollSize = 200;
+const unsigned kPartialUnrollSize = 400;
+
+Value* lookup(ValueToValueMapTy& vmap, Value* v)
+{
+	auto found = vmap.find(v);
+	if (found != vmap.end())
+	{
+		return found->second;
+	}
+	return v;
+}
+
+bool evaluate(CmpInst::Predicate pred, int64_t lhs, int64_t rhs)
+{
+	switch (pred)
+	{
+		case CmpInst::ICMP_EQ:
+			return lhs == rhs;
+		case CmpInst::ICMP_NE:
+			return lhs != rhs;
+		case CmpInst::ICMP_SLT:
+			return lhs < rhs;
+		case CmpInst::ICMP_SLE:
+			return lhs <= rhs;
+		case CmpInst::ICMP_SGT:
+			return lhs > rhs;
+		case CmpInst::ICMP_SGE:
+			return lhs >= rhs;
+		default:
+			return false;
+	}
+}
+
+// Clones blocks of a loop once, ahead of insertBefore. On entry entry[i]
+// is the value of phis[i] (the header PHIs) for this iteration. On return
+// vmap maps every cloned block and value to its copy, and the copies of
+// the header PHIs are gone.
+void cloneIteration(const std::vector<BasicBlock*>& blocks,
+					const std::vector<PHINode*>& phis,
+					const std::vector<Value*>& entry,
+					ValueToValueMapTy& vmap, BasicBlock* insertBefore)
+{
+	Function* F = insertBefore->getParent();
+	std::vector<BasicBlock*> copies;
+	for (BasicBlock* block : blocks)
+	{
+		BasicBlock* copy = CloneBasicBlock(block, vmap, ".unroll", F);
+		copy->moveBefore(insertBefore);
+		vmap[block] = copy;
+		copies.push_back(copy);
+	}
+
+	for (size_t i = 0; i < phis.size(); i++)
+	{
+		Instruction* copy = cast<Instruction>(lookup(vmap, phis[i]));
+		vmap[phis[i]] = entry[i];
+		copy->eraseFromParent();
+	}
+
+	for (BasicBlock* copy : copies)
+	{
+		for (Instruction& I : *copy)
+		{
+			RemapInstruction(&I, vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+		}
+	}
+
+	// In a fully unrolled loop the induction variable is a constant in
+	// each copy, so fold whatever now has constant operands (vmap follows
+	// the replacement)
+	for (BasicBlock* copy : copies)
+	{
+		BasicBlock::iterator iter = copy->begin();
+		while (iter != copy->end())
+		{
+			Instruction* I = iter;
+			++iter;
+			if (Constant* C = ConstantFoldInstruction(I))
+			{
+				I->replaceAllUsesWith(C);
+				I->eraseFromParent();
+			}
+		}
+	}
+}
+
+// The condition of this header copy is known to hold (or not), so it
+// branches straight to dest
+void replaceBranch(BasicBlock* header, BasicBlock* dest)
+{
+	BranchInst* br = cast<BranchInst>(header->getTerminator());
+	Value* cond = br->isConditional() ? br->getCondition() : nullptr;
+	BranchInst::Create(dest, br);
+	br->eraseFromParent();
+
+	Instruction* condInstr = dyn_cast_or_null<Instruction>(cond);
+	if (condInstr != nullptr && isInstructionTriviallyDead(condInstr))
+	{
+		condInstr->eraseFromParent();
+	}
+}
+
+} // anonymous namespace
+
+namespace uscc
+{
+namespace opt
+{
+
+// Innermost loops never share blocks, so a pass can rewrite each of
+// them without disturbing the others
+void collectInnermostLoops(LoopInfo& loopInfo, std::vector<Loop*>& loops)
+{
+	std::vector<Loop*> worklist(loopInfo.begin(), loopInfo.end());
+	while (!worklist.empty())
+	{
+		Loop* L = worklist.back();
+		worklist.pop_back();
+		if (L->empty())
+		{
+			loops.push_back(L);
+		}
+		worklist.insert(worklist.end(), L->begin(), L->end());
+	}
+}
+
+bool getInductionStep(PHINode* iv, BasicBlock* latch, int64_t& step)
+{
+	if (iv->getBasicBlockIndex(latch) < 0)
+	{
+		return false;
+	}
+	BinaryOperator* inc = dyn_cast<BinaryOperator>(iv->getIncomingValueForBlock(latch));
+	if (inc == nullptr)
+	{
+		return false;
+	}
+
+	ConstantInt* amount = nullptr;
+	int64_t sign = 1;
+	if (inc->getOpcode() == Instruction::Add)
+	{
+		if (inc->getOperand(0) == iv)
+		{
+			amount = dyn_cast<ConstantInt>(inc->getOperand(1));
+		}
+		else if (inc->getOperand(1) == iv)
+		{
+			amount = dyn_cast<ConstantInt>(inc->getOperand(0));
+		}
+	}
+	else if (inc->getOpcode() == Instruction::Sub && inc->getOperand(0) == iv)
+	{
+		amount = dyn_cast<ConstantInt>(inc->getOperand(1));
+		sign = -1;
+	}
+	if (amount == nullptr || amount->isZero() || amount->getBitWidth() > 32)
+	{
+		return false;
+	}
+
+	step = sign * amount->getSExtValue();
+	return true;
+}
+
+// Matches the loops ASTWhileStmt emits once SSABuilder has turned the
+// counter into a header PHI: the header is the only block that leaves
+// the loop, and it tests the PHI against a loop invariant bound
+bool LoopUnroll::analyzeLoop(Loop* L, CountedLoop& info)
+{
+	BasicBlock* header = L->getHeader();
+	BasicBlock* preheader = L->getLoopPreheader();
+	BasicBlock* latch = L->getLoopLatch();
+	if (!L->empty() || preheader == nullptr || latch == nullptr ||
+		latch == header || L->getExitingBlock() != header ||
+		L->getExitBlock() == nullptr)
+	{
+		return false;
+	}
+
+	BranchInst* br = dyn_cast<BranchInst>(header->getTerminator());
+	if (br == nullptr || !br->isConditional())
+	{
+		return false;
+	}
+	ICmpInst* cmp = dyn_cast<ICmpInst>(br->getCondition());
+	if (cmp == nullptr || cmp->isUnsigned())
+	{
+		return false;
+	}
+
+	CmpInst::Predicate pred = cmp->getPredicate();
+	Value* bound = cmp->getOperand(1);
+	PHINode* iv = dyn_cast<PHINode>(cmp->getOperand(0));
+	if (iv == nullptr || iv->getParent() != header)
+	{
+		bound = cmp->getOperand(0);
+		iv = dyn_cast<PHINode>(cmp->getOperand(1));
+		pred = CmpInst::getSwappedPredicate(pred);
+	}
+	if (iv == nullptr || iv->getParent() != header ||
+		!L->isLoopInvariant(bound) || !iv->getType()->isIntegerTy() ||
+		iv->getType()->getIntegerBitWidth() > 32)
+	{
+		return false;
+	}
+
+	info.mBody = br->getSuccessor(0);
+	info.mExit = br->getSuccessor(1);
+	if (!L->contains(info.mBody))
+	{
+		std::swap(info.mBody, info.mExit);
+		pred = CmpInst::getInversePredicate(pred);
+	}
+
+	if (!getInductionStep(iv, latch, info.mStep))
+	{
+		return false;
+	}
+
+	info.mIndVar = iv;
+	info.mStart = iv->getIncomingValueForBlock(preheader);
+	info.mBound = bound;
+	info.mPred = pred;
+	return true;
+}
+
+// while (i < n) { ...; ++i; } with the body a single block and the
+// header only the induction variable, the test and the branch, so
+// nothing but the body needs rewriting to run it some other way
+bool LoopUnroll::isSimpleCountedLoop(Loop* L, const CountedLoop& info)
+{
+	BasicBlock* header = L->getHeader();
+	if (info.mStep != 1 ||
+		(info.mPred != CmpInst::ICMP_SLT && info.mPred != CmpInst::ICMP_SLE) ||
+		L->getBlocks().size() != 2 || L->getLoopLatch() != info.mBody)
+	{
+		return false;
+	}
+
+	Instruction* cond = cast<Instruction>(cast<BranchInst>(header->getTerminator())->getCondition());
+	for (Instruction& I : *header)
+	{
+		if (&I != info.mIndVar && &I != cond && &I != header->getTerminator())
+		{
+			return false;
+		}
+	}
+	return cond->hasOneUse();
+}
+
+// Runs the loop test on constants; -1 if the count is not a constant,
+// is over limit or the counter would wrap
+int64_t LoopUnroll::constantTripCount(const CountedLoop& info, int64_t limit)
+{
+	ConstantInt* start = dyn_cast<ConstantInt>(info.mStart);
+	ConstantInt* bound = dyn_cast<ConstantInt>(info.mBound);
+	if (start == nullptr || bound == nullptr)
+	{
+		return -1;
+	}
+
+	unsigned bits = start->getType()->getIntegerBitWidth();
+	int64_t value = start->getSExtValue();
+	for (int64_t trips = 0; trips <= limit; trips++)
+	{
+		if (!evaluate(info.mPred, value, bound->getSExtValue()))
+		{
+			return trips;
+		}
+		value += info.mStep;
+		if (!isIntN(bits, value))
+		{
+			return -1;
+		}
+	}
+	return -1;
+}
+
+unsigned LoopUnroll::loopSize(Loop* L)
+{
+	unsigned size = 0;
+	for (BasicBlock* block : L->getBlocks())
+	{
+		for (Instruction& I : *block)
+		{
+			if (!isa<PHINode>(I))
+			{
+				size++;
+			}
+		}
+	}
+	return size;
+}
+
+// Lays out trips copies of the loop followed by a last copy of the header
+// that goes to the exit, then deletes the loop
+void LoopUnroll::fullyUnroll(Loop* L, const CountedLoop& info, unsigned trips)
+{
+	BasicBlock* header = L->getHeader();
+	BasicBlock* preheader = L->getLoopPreheader();
+	BasicBlock* latch = L->getLoopLatch();
+	std::vector<BasicBlock*> blocks(L->getBlocks().begin(), L->getBlocks().end());
+	std::vector<BasicBlock*> headerOnly(1, header);
+
+	std::vector<PHINode*> phis;
+	std::vector<Value*> entry;
+	for (BasicBlock::iterator iter = header->begin(); isa<PHINode>(iter); ++iter)
+	{
+		PHINode* phi = cast<PHINode>(iter);
+		phis.push_back(phi);
+		entry.push_back(phi->getIncomingValueForBlock(preheader));
+	}
+
+	ValueToValueMapTy vmap;
+	BasicBlock* pred = preheader;
+	BasicBlock* predTarget = header;
+	for (unsigned k = 0; k <= trips; k++)
+	{
+		bool last = (k == trips);
+		vmap.clear();
+		cloneIteration(last ? headerOnly : blocks, phis, entry, vmap, header);
+
+		BasicBlock* headerCopy = cast<BasicBlock>(lookup(vmap, header));
+		pred->getTerminator()->replaceUsesOfWith(predTarget, headerCopy);
+		if (last)
+		{
+			replaceBranch(headerCopy, info.mExit);
+		}
+		else
+		{
+			replaceBranch(headerCopy, cast<BasicBlock>(lookup(vmap, info.mBody)));
+			pred = cast<BasicBlock>(lookup(vmap, latch));
+			predTarget = headerCopy;
+			for (size_t i = 0; i < phis.size(); i++)
+			{
+				entry[i] = lookup(vmap, phis[i]->getIncomingValueForBlock(latch));
+			}
+		}
+	}
+
+	// Only header values can be used after the loop (the header is the only
+	// way out), and those now come from the last header copy
+	BasicBlock* lastHeader = cast<BasicBlock>(lookup(vmap, header));
+	for (Instruction& I : *header)
+	{
+		Value* mapped = lookup(vmap, &I);
+		std::vector<Use*> outside;
+		for (Use& U : I.uses())
+		{
+			if (!L->contains(cast<Instruction>(U.getUser())->getParent()))
+			{
+				outside.push_back(&U);
+			}
+		}
+		for (Use* U : outside)
+		{
+			U->set(mapped);
+		}
+	}
+	for (BasicBlock::iterator iter = info.mExit->begin(); isa<PHINode>(iter); ++iter)
+	{
+		PHINode* phi = cast<PHINode>(iter);
+		int index = phi->getBasicBlockIndex(header);
+		if (index >= 0)
+		{
+			phi->setIncomingBlock(index, lastHeader);
+		}
+	}
+
+	for (BasicBlock* block : blocks)
+	{
+		block->dropAllReferences();
+	}
+	for (BasicBlock* block : blocks)
+	{
+		block->eraseFromParent();
+	}
+}
+
+// Puts a new loop ahead of the original one that runs count copies of the
+// body per trip, as long as the last of those iterations would still run.
+// The original loop then finishes the iterations that are left.
+void LoopUnroll::partiallyUnroll(Loop* L, const CountedLoop& info, unsigned count)
+{
+	BasicBlock* header = L->getHeader();
+	BasicBlock* preheader = L->getLoopPreheader();
+	BasicBlock* latch = L->getLoopLatch();
+	Function* F = header->getParent();
+	LLVMContext& ctx = F->getContext();
+	std::vector<BasicBlock*> blocks(L->getBlocks().begin(), L->getBlocks().end());
+
+	BasicBlock* mainHeader = BasicBlock::Create(ctx, "unroll.cond", F, header);
+	BasicBlock* remainder = BasicBlock::Create(ctx, "unroll.remainder", F, header);
+
+	std::vector<PHINode*> phis;
+	std::vector<PHINode*> mainPhis;
+	std::vector<Value*> entry;
+	PHINode* mainIndVar = nullptr;
+	for (BasicBlock::iterator iter = header->begin(); isa<PHINode>(iter); ++iter)
+	{
+		PHINode* phi = cast<PHINode>(iter);
+		PHINode* mainPhi = PHINode::Create(phi->getType(), 2, phi->getName() + ".unroll", mainHeader);
+		mainPhi->addIncoming(phi->getIncomingValueForBlock(preheader), preheader);
+		phis.push_back(phi);
+		mainPhis.push_back(mainPhi);
+		entry.push_back(mainPhi);
+		if (phi == info.mIndVar)
+		{
+			mainIndVar = mainPhi;
+		}
+	}
+
+	// Compare in 64 bits so the look-ahead cannot wrap
+	IRBuilder<> builder(mainHeader);
+	Type* i64 = builder.getInt64Ty();
+	Value* ahead = builder.CreateAdd(builder.CreateSExt(mainIndVar, i64),
+		ConstantInt::get(i64, info.mStep * static_cast<int64_t>(count - 1)), "unroll.last");
+	Value* check = builder.CreateICmp(info.mPred, ahead,
+		builder.CreateSExt(info.mBound, i64), "unroll.check");
+	BranchInst* mainBr = builder.CreateCondBr(check, mainHeader, remainder);
+	builder.SetInsertPoint(remainder);
+	builder.CreateBr(header);
+
+	preheader->getTerminator()->replaceUsesOfWith(header, mainHeader);
+	for (size_t i = 0; i < phis.size(); i++)
+	{
+		int index = phis[i]->getBasicBlockIndex(preheader);
+		phis[i]->setIncomingBlock(index, remainder);
+		phis[i]->setIncomingValue(index, mainPhis[i]);
+	}
+
+	ValueToValueMapTy vmap;
+	BasicBlock* pred = nullptr;
+	BasicBlock* predTarget = nullptr;
+	for (unsigned k = 0; k < count; k++)
+	{
+		vmap.clear();
+		cloneIteration(blocks, phis, entry, vmap, mainHeader->getNextNode());
+
+		BasicBlock* headerCopy = cast<BasicBlock>(lookup(vmap, header));
+		if (pred == nullptr)
+		{
+			mainBr->setSuccessor(0, headerCopy);
+		}
+		else
+		{
+			pred->getTerminator()->replaceUsesOfWith(predTarget, headerCopy);
+		}
+		replaceBranch(headerCopy, cast<BasicBlock>(lookup(vmap, info.mBody)));
+
+		pred = cast<BasicBlock>(lookup(vmap, latch));
+		predTarget = headerCopy;
+		for (size_t i = 0; i < phis.size(); i++)
+		{
+			entry[i] = lookup(vmap, phis[i]->getIncomingValueForBlock(latch));
+		}
+	}
+
+	pred->getTerminator()->replaceUsesOfWith(predTarget, mainHeader);
+	for (size_t i = 0; i < mainPhis.size(); i++)
+	{
+		mainPhis[i]->addIncoming(entry[i], pred);
+	}
+}
+
+bool LoopUnroll::runOnFunction(Function& F)
+{
+	mNumFull = 0;
+	mNumPartial = 0;
+
+	// Unrolling only touches innermost loops, so they can all be
+	// collected up front
+	LoopInfo& loopInfo = getAnalysis<LoopInfo>();
+	std::vector<Loop*> innermost;
+	collectInnermostLoops(loopInfo, innermost);
+
+	for (Loop* L : innermost)
+	{
+		CountedLoop info;
+		if (!analyzeLoop(L, info))
+		{
+			continue;
+		}
+
+		unsigned size = loopSize(L);
+		int64_t trips = constantTripCount(info, kFullUnrollSize / size);
+		unsigned count = gOptOptions.unrollCount;
+		if (trips >= 0 && trips * size <= kFullUnrollSize)
+		{
+			fullyUnroll(L, info, static_cast<unsigned>(trips));
+			++mNumFull;
+		}
+		else if (count > 1 && size * count <= kPartialUnrollSize)
+		{
+			// The look-ahead test needs the counter to move toward the bound
+			bool up = info.mStep > 0 &&
+				(info.mPred == CmpInst::ICMP_SLT || info.mPred == CmpInst::ICMP_SLE);
+			bool down = info.mStep < 0 &&
+				(info.mPred == CmpInst::ICMP_SGT || info.mPred == CmpInst::ICMP_SGE);
+			if (up || down)
+			{
+				partiallyUnroll(L, info, count);
+				++mNumPartial;
+			}
+		}
+	}
+
+	if (gOptOptions.stats)
+	{
+		outs() << "Unroll: " << F.getName() << ": fully unrolled " << mNumFull
+			<< " loops, partially unrolled " << mNumPartial << " loops\n";
+	}
+	return mNumFull + mNumPartial > 0;
+}
+
+void LoopUnroll::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// The loops are rebuilt, so nothing is preserved
+	Info.addRequired<LoopInfo>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::LoopUnroll::ID = 0;
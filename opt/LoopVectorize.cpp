@@ -0,0 +1,513 @@
+//
+//  LoopVectorize.cpp
+//  uscc
+//
+//  Implements vectorization of simple counted loops over
+//  char[] and int[] -- the vector loop is followed by the
+//  original loop as a scalar epilogue
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+#include <set>
+
+using namespace llvm;
+
+namespace
+{
+
+// Builds the vector form of the loop body's values
+class Widener
+{
+public:
+	Widener(IRBuilder<>& builder, BasicBlock* preheader, PHINode* indVar,
+			Value* vecIndVar, unsigned width)
+	: mBuilder(builder)
+	, mPreheader(preheader)
+	, mIndVar(indVar)
+	, mVecIndVar(vecIndVar)
+	, mWidth(width)
+	{
+	}
+
+	void set(Value* scalar, Value* vector)
+	{
+		mWidened[scalar] = vector;
+	}
+
+	// Loop invariant values are splatted in the preheader, and the
+	// induction variable becomes <iv, iv + 1, ...>
+	Value* get(Value* scalar)
+	{
+		auto found = mWidened.find(scalar);
+		if (found != mWidened.end())
+		{
+			return found->second;
+		}
+
+		Value* vector = nullptr;
+		if (Constant* C = dyn_cast<Constant>(scalar))
+		{
+			vector = ConstantVector::getSplat(mWidth, C);
+		}
+		else if (scalar == mIndVar)
+		{
+			std::vector<Constant*> lanes;
+			for (unsigned i = 0; i < mWidth; i++)
+			{
+				lanes.push_back(ConstantInt::get(scalar->getType(), i));
+			}
+			vector = mBuilder.CreateAdd(mBuilder.CreateVectorSplat(mWidth, mVecIndVar),
+				ConstantVector::get(lanes), "vec.lanes");
+		}
+		else
+		{
+			IRBuilder<> pre(mPreheader->getTerminator());
+			vector = pre.CreateVectorSplat(mWidth, scalar, "vec.splat");
+		}
+		mWidened[scalar] = vector;
+		return vector;
+	}
+
+	// <width x T>* for the address of lane 0
+	Value* address(Value* scalarPtr, Type* elementType)
+	{
+		Type* vectorPtr = PointerType::get(VectorType::get(elementType, mWidth),
+			cast<PointerType>(scalarPtr->getType())->getAddressSpace());
+		return mBuilder.CreateBitCast(scalarPtr, vectorPtr, "vec.addr");
+	}
+
+private:
+	IRBuilder<>& mBuilder;
+	BasicBlock* mPreheader;
+	PHINode* mIndVar;
+	Value* mVecIndVar;
+	unsigned mWidth;
+	std::unordered_map<Value*, Value*> mWidened;
+};
+
+// Vector accesses only get element alignment
+unsigned elementAlignment(Type* type)
+{
+	return type->getPrimitiveSizeInBits() / 8;
+}
+
+// sext/zext from i8, the only way char values reach int arithmetic
+bool isCharExtend(Value* value)
+{
+	CastInst* castInstr = dyn_cast<CastInst>(value);
+	return castInstr != nullptr && castInstr->getSrcTy()->isIntegerTy(8) &&
+		(castInstr->getOpcode() == Instruction::SExt ||
+		 castInstr->getOpcode() == Instruction::ZExt);
+}
+
+// The emitter does char arithmetic by extending to i32 and truncating
+// the result back to i8. The low 8 bits of an add, sub, mul or bitwise
+// op only depend on the low 8 bits of its operands, so when every use
+// of one truncates to i8 (possibly through more such ops), and its
+// operands are extended chars or constants, it can be done in i8.
+void findCharArithmetic(BasicBlock* body, std::set<Instruction*>& narrowed)
+{
+	for (Instruction& I : *body)
+	{
+		BinaryOperator* op = dyn_cast<BinaryOperator>(&I);
+		if (op == nullptr || op->getType()->getIntegerBitWidth() <= 8)
+		{
+			continue;
+		}
+		switch (op->getOpcode())
+		{
+			case Instruction::Add:
+			case Instruction::Sub:
+			case Instruction::Mul:
+			case Instruction::And:
+			case Instruction::Or:
+			case Instruction::Xor:
+				narrowed.insert(op);
+				break;
+			default:
+				break;
+		}
+	}
+
+	// Drop ops that need more than 8 bits until the rest agree
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		auto iter = narrowed.begin();
+		while (iter != narrowed.end())
+		{
+			Instruction* I = *iter;
+			bool narrow = true;
+			for (Value* operand : I->operands())
+			{
+				Instruction* opInstr = dyn_cast<Instruction>(operand);
+				if (!isa<Constant>(operand) && !isCharExtend(operand) &&
+					(opInstr == nullptr || narrowed.count(opInstr) == 0))
+				{
+					narrow = false;
+				}
+			}
+			for (User* user : I->users())
+			{
+				Instruction* userInstr = cast<Instruction>(user);
+				if (!(isa<TruncInst>(userInstr) && userInstr->getType()->isIntegerTy(8)) &&
+					narrowed.count(userInstr) == 0)
+				{
+					narrow = false;
+				}
+			}
+			if (narrow)
+			{
+				++iter;
+			}
+			else
+			{
+				iter = narrowed.erase(iter);
+				changed = true;
+			}
+		}
+	}
+}
+
+// A char extend that only feeds narrowed ops, or a trunc of a narrowed
+// op, has nothing left to do once the op works on i8
+bool isNarrowedCast(CastInst* castInstr, const std::set<Instruction*>& narrowed)
+{
+	if (isa<TruncInst>(castInstr))
+	{
+		Instruction* operand = dyn_cast<Instruction>(castInstr->getOperand(0));
+		return operand != nullptr && narrowed.count(operand) != 0;
+	}
+	if (!isCharExtend(castInstr) || castInstr->use_empty())
+	{
+		return false;
+	}
+	for (User* user : castInstr->users())
+	{
+		if (narrowed.count(cast<Instruction>(user)) == 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+namespace uscc
+{
+namespace opt
+{
+
+// Every access must be a[i] for the induction variable i itself, and
+// USC has no pointer arithmetic, so two arrays are either the same or
+// disjoint. Each lane then only touches its own element, and running
+// the body's accesses in order a vector at a time keeps every
+// dependence the scalar loop had.
+//
+// The width is the vector size over the widest scalar left once char
+// arithmetic is narrowed, so a loop over char[] alone gets <16 x i8>.
+bool LoopVectorize::canVectorize(Loop* L, const LoopUnroll::CountedLoop& info,
+								 unsigned& width, std::set<Instruction*>& narrowed) const
+{
+	BasicBlock* header = L->getHeader();
+	BasicBlock* body = info.mBody;
+	if (!LoopUnroll::isSimpleCountedLoop(L, info))
+	{
+		return false;
+	}
+
+	findCharArithmetic(body, narrowed);
+	unsigned maxBits = 0;
+	for (Instruction& I : *body)
+	{
+		if (isa<TerminatorInst>(I))
+		{
+			continue;
+		}
+		for (Value* op : I.operands())
+		{
+			Instruction* opInstr = dyn_cast<Instruction>(op);
+			if (opInstr != nullptr && opInstr->getParent() == header &&
+				opInstr != info.mIndVar)
+			{
+				return false;
+			}
+		}
+
+		Type* type = I.getType();
+		if (GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(&I))
+		{
+			if (gep->getNumIndices() != 1 || gep->getOperand(1) != info.mIndVar ||
+				!L->isLoopInvariant(gep->getPointerOperand()))
+			{
+				return false;
+			}
+			for (User* user : gep->users())
+			{
+				LoadInst* load = dyn_cast<LoadInst>(user);
+				StoreInst* store = dyn_cast<StoreInst>(user);
+				if (load == nullptr &&
+					(store == nullptr || store->getPointerOperand() != gep ||
+					 store->getValueOperand() == gep))
+				{
+					return false;
+				}
+			}
+			continue;
+		}
+		else if (LoadInst* load = dyn_cast<LoadInst>(&I))
+		{
+			GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(load->getPointerOperand());
+			if (!load->isSimple() || gep == nullptr || gep->getParent() != body)
+			{
+				return false;
+			}
+		}
+		else if (StoreInst* store = dyn_cast<StoreInst>(&I))
+		{
+			GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(store->getPointerOperand());
+			if (!store->isSimple() || gep == nullptr || gep->getParent() != body)
+			{
+				return false;
+			}
+			type = store->getValueOperand()->getType();
+		}
+		else if (BinaryOperator* op = dyn_cast<BinaryOperator>(&I))
+		{
+			// Division could trap in a lane the scalar loop never runs
+			switch (op->getOpcode())
+			{
+				case Instruction::SDiv:
+				case Instruction::UDiv:
+				case Instruction::SRem:
+				case Instruction::URem:
+					return false;
+				default:
+					break;
+			}
+			if (narrowed.count(op) != 0)
+			{
+				type = Type::getInt8Ty(op->getContext());
+			}
+		}
+		else if (CastInst* castInstr = dyn_cast<CastInst>(&I))
+		{
+			if (castInstr->getOpcode() != Instruction::SExt &&
+				castInstr->getOpcode() != Instruction::ZExt &&
+				castInstr->getOpcode() != Instruction::Trunc)
+			{
+				return false;
+			}
+			Type* src = castInstr->getSrcTy();
+			if (isNarrowedCast(castInstr, narrowed))
+			{
+				type = Type::getInt8Ty(castInstr->getContext());
+			}
+			else if (src->isIntegerTy() && src->getIntegerBitWidth() > maxBits)
+			{
+				maxBits = src->getIntegerBitWidth();
+			}
+		}
+		else if (ICmpInst* cmp = dyn_cast<ICmpInst>(&I))
+		{
+			type = cmp->getOperand(0)->getType();
+		}
+		else
+		{
+			return false;
+		}
+
+		if (!type->isIntegerTy())
+		{
+			return false;
+		}
+		if (type->getIntegerBitWidth() > maxBits)
+		{
+			maxBits = type->getIntegerBitWidth();
+		}
+	}
+
+	if (maxBits == 0)
+	{
+		return false;
+	}
+	width = mVectorBits / maxBits;
+	return width >= 2;
+}
+
+// Same layout as a partially unrolled loop: vec.cond checks that the
+// last lane's iteration would still run, vec.body does width iterations
+// at once, and vec.remainder hands what is left to the original loop
+void LoopVectorize::vectorize(Loop* L, const LoopUnroll::CountedLoop& info,
+							  unsigned width, const std::set<Instruction*>& narrowed)
+{
+	BasicBlock* header = L->getHeader();
+	BasicBlock* preheader = L->getLoopPreheader();
+	BasicBlock* body = info.mBody;
+	Function* F = header->getParent();
+	LLVMContext& ctx = F->getContext();
+	Type* ivType = info.mIndVar->getType();
+
+	BasicBlock* vecHeader = BasicBlock::Create(ctx, "vec.cond", F, header);
+	BasicBlock* vecBody = BasicBlock::Create(ctx, "vec.body", F, header);
+	BasicBlock* remainder = BasicBlock::Create(ctx, "vec.remainder", F, header);
+
+	IRBuilder<> builder(vecHeader);
+	PHINode* vecIndVar = builder.CreatePHI(ivType, 2, "vec.iv");
+	vecIndVar->addIncoming(info.mStart, preheader);
+	Type* i64 = builder.getInt64Ty();
+	Value* ahead = builder.CreateAdd(builder.CreateSExt(vecIndVar, i64),
+		ConstantInt::get(i64, width - 1), "vec.last");
+	Value* check = builder.CreateICmp(info.mPred, ahead,
+		builder.CreateSExt(info.mBound, i64), "vec.check");
+	builder.CreateCondBr(check, vecBody, remainder);
+	builder.SetInsertPoint(remainder);
+	builder.CreateBr(header);
+
+	preheader->getTerminator()->replaceUsesOfWith(header, vecHeader);
+	int index = info.mIndVar->getBasicBlockIndex(preheader);
+	info.mIndVar->setIncomingBlock(index, remainder);
+	info.mIndVar->setIncomingValue(index, vecIndVar);
+
+	builder.SetInsertPoint(vecBody);
+	Widener widener(builder, preheader, info.mIndVar, vecIndVar, width);
+	Value* increment = info.mIndVar->getIncomingValueForBlock(body);
+	for (Instruction& I : *body)
+	{
+		// vec.iv.next takes the place of the scalar increment
+		if (&I == increment && I.hasOneUse())
+		{
+			continue;
+		}
+		if (GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(&I))
+		{
+			// The scalar address of lane 0
+			widener.set(gep, builder.CreateGEP(gep->getPointerOperand(), vecIndVar));
+		}
+		else if (LoadInst* load = dyn_cast<LoadInst>(&I))
+		{
+			Value* addr = widener.address(widener.get(load->getPointerOperand()), load->getType());
+			LoadInst* vecLoad = builder.CreateLoad(addr);
+			vecLoad->setAlignment(elementAlignment(load->getType()));
+			widener.set(load, vecLoad);
+		}
+		else if (StoreInst* store = dyn_cast<StoreInst>(&I))
+		{
+			Type* type = store->getValueOperand()->getType();
+			Value* addr = widener.address(widener.get(store->getPointerOperand()), type);
+			StoreInst* vecStore = builder.CreateStore(widener.get(store->getValueOperand()), addr);
+			vecStore->setAlignment(elementAlignment(type));
+		}
+		else if (BinaryOperator* op = dyn_cast<BinaryOperator>(&I))
+		{
+			Value* operands[2];
+			for (unsigned i = 0; i < 2; i++)
+			{
+				Value* operand = op->getOperand(i);
+				if (narrowed.count(op) != 0)
+				{
+					// The i8 form of an extended char or a constant
+					if (isCharExtend(operand))
+					{
+						operand = cast<CastInst>(operand)->getOperand(0);
+					}
+					else if (Constant* C = dyn_cast<Constant>(operand))
+					{
+						operand = ConstantExpr::getTrunc(C, builder.getInt8Ty());
+					}
+				}
+				operands[i] = widener.get(operand);
+			}
+			widener.set(op, builder.CreateBinOp(op->getOpcode(), operands[0], operands[1]));
+		}
+		else if (CastInst* castInstr = dyn_cast<CastInst>(&I))
+		{
+			if (isNarrowedCast(castInstr, narrowed))
+			{
+				// The trunc of a narrowed op is the op itself; the
+				// extends are skipped by the ops that use them
+				if (isa<TruncInst>(castInstr))
+				{
+					widener.set(castInstr, widener.get(castInstr->getOperand(0)));
+				}
+				continue;
+			}
+			widener.set(castInstr, builder.CreateCast(castInstr->getOpcode(),
+				widener.get(castInstr->getOperand(0)),
+				VectorType::get(castInstr->getDestTy(), width)));
+		}
+		else if (ICmpInst* cmp = dyn_cast<ICmpInst>(&I))
+		{
+			widener.set(cmp, builder.CreateICmp(cmp->getPredicate(),
+				widener.get(cmp->getOperand(0)), widener.get(cmp->getOperand(1))));
+		}
+	}
+
+	Value* next = builder.CreateAdd(vecIndVar, ConstantInt::get(ivType, width), "vec.iv.next");
+	builder.CreateBr(vecHeader);
+	vecIndVar->addIncoming(next, vecBody);
+}
+
+bool LoopVectorize::runOnFunction(Function& F)
+{
+	mNumVectorized = 0;
+	mVectorBits = gOptOptions.targetFeatures.find("+avx2") != std::string::npos ? 256 : 128;
+
+	LoopInfo& loopInfo = getAnalysis<LoopInfo>();
+	std::vector<Loop*> innermost;
+	collectInnermostLoops(loopInfo, innermost);
+
+	for (Loop* L : innermost)
+	{
+		LoopUnroll::CountedLoop info;
+		unsigned width;
+		std::set<Instruction*> narrowed;
+		if (!LoopUnroll::analyzeLoop(L, info) || !canVectorize(L, info, width, narrowed))
+		{
+			continue;
+		}
+		// Not worth it if the vector loop would never run
+		int64_t trips = LoopUnroll::constantTripCount(info, width);
+		if (trips >= 0 && trips < static_cast<int64_t>(width))
+		{
+			continue;
+		}
+		vectorize(L, info, width, narrowed);
+		++mNumVectorized;
+	}
+
+	if (gOptOptions.stats)
+	{
+		outs() << "Vectorize: " << F.getName() << ": vectorized "
+			<< mNumVectorized << " loops\n";
+	}
+	return mNumVectorized > 0;
+}
+
+void LoopVectorize::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Adds a vector loop ahead of each loop, so nothing is preserved
+	Info.addRequired<LoopInfo>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::LoopVectorize::ID = 0;
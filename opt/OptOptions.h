@@ -0,0 +1,46 @@
+//
+//  OptOptions.h
+//  uscc
+//
+//  Declares the options that control the -O passes
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#pragma once
+#include <string>
+
+namespace uscc
+{
+namespace opt
+{
+
+// These are set by the driver before the opt passes run
+struct OptOptions
+{
+	// Print what each pass changed, per function, to stdout
+	bool stats = false;
+	
+	// Unroll factor for counted loops that are not fully unrolled
+	// (1 disables partial unrolling)
+	unsigned unrollCount = 4;
+	
+	// Largest inline cost, in instructions, of a call that is inlined
+	// (0 disables inlining)
+	unsigned inlineThreshold = 50;
+	
+	// Target CPU (empty for the host) and features for the backend; the
+	// loop vectorizer picks its vector width from the features
+	std::string targetCPU;
+	std::string targetFeatures;
+};
+
+extern OptOptions gOptOptions;
+
+} // opt
+} // uscc
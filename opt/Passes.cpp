@@ -25,15 +25,25 @@ namespace uscc
 namespace opt
 {
 
+OptOptions gOptOptions;
+
 void registerOptPasses(legacy::PassManager& pm)
 {
 	PassRegistry& pr = *PassRegistry::getPassRegistry();
 	initializeLoopInfoPass(pr);
 	initializeDominatorTreeWrapperPassPass(pr);
-	pm.add(new ConstantOps());
-	pm.add(new ConstantBranch());
-	pm.add(new DeadBlocks());
+	pm.add(new Inliner());
+	pm.add(new TailRecursion());
+	pm.add(new SCCP());
+	pm.add(new JumpThreading());
+	pm.add(new SimplifyCFG());
+	pm.add(new GVN());
 	pm.add(new LICM());
+	pm.add(new LoopIdiom());
+	pm.add(new LoopVectorize());
+	pm.add(new StrengthReduce());
+	pm.add(new LoopUnroll());
+	pm.add(new SimplifyCFG(false));
 	pm.add(new DominatorTreeWrapperPass());
 	pm.add(new LoopInfo());
 }
@@ -4,13 +4,23 @@
 //
 //  Declares the opt passes supported by USCC
 //
-//  At the moment, there are four passes:
-//     * Constant op removal
-//     * Constant branch folding
-//     * Removal of dead blocks from CFG
+//  At the moment, uscc -O runs these eleven passes, in order:
+//     * Function inlining
+//     * Tail recursion elimination
+//     * Sparse conditional constant propagation (SCCP)
+//     * Jump threading
+//     * CFG simplification
+//     * Global value numbering (GVN)
 //     * Loop Invariant Code Motion (LICM)
+//     * Loop idiom recognition (memset/memcpy)
+//     * Loop vectorization
+//     * Induction variable strength reduction
+//     * Loop unrolling
+//  and CFG simplification runs again after the loop passes.
 //
-//  These passes will execute if uscc is ran with -O
+//  Constant op removal, constant branch folding and removal of dead
+//  blocks from CFG are still declared here, but are not scheduled:
+//  CFG simplification does their work.
 //
 //---------------------------------------------------------
 //  Copyright (c) 2014, Sanjay Madhav
@@ -26,10 +36,21 @@
 #include <llvm/Analysis/LoopPass.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instructions.h>
 #pragma clang diagnostic pop
+#include "OptOptions.h"
+#include <cstdint>
+#include <map>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 using llvm::FunctionPass;
 using llvm::LoopPass;
+using llvm::ModulePass;
 
 namespace uscc
 {
@@ -41,6 +62,116 @@ namespace opt
 void registerOptPasses(llvm::legacy::PassManager& pm);
 void registerAnalysisPasses(llvm::PassRegistry &Registry);
 
+// Matches the latch update of an induction variable PHI, iv + C or
+// iv - C, and returns the signed step
+bool getInductionStep(llvm::PHINode* iv, llvm::BasicBlock* latch, int64_t& step);
+
+// Appends the loops that contain no other loop
+void collectInnermostLoops(llvm::LoopInfo& loopInfo, std::vector<llvm::Loop*>& loops);
+
+// Bottom-up inliner: callees are visited before their callers, and a
+// call is inlined when the callee's size, less credit for the call
+// overhead and for constant or local array arguments, is within
+// --inline-threshold
+struct Inliner : public ModulePass
+{
+	static char ID;
+	Inliner() : ModulePass(ID) {}
+	
+	virtual bool runOnModule(llvm::Module& M) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	static int inlineCost(llvm::CallInst* call, llvm::Function* callee);
+	void visit(llvm::Function* F);
+	bool inlineCalls(llvm::Function* F);
+	
+	// Functions in the order they are processed (callees first)
+	std::vector<llvm::Function*> mOrder;
+	std::set<llvm::Function*> mStarted;
+	
+	// Functions whose own calls have been inlined
+	std::set<llvm::Function*> mDone;
+};
+
+// Turns self tail calls into a branch back to the top of the function,
+// with PHIs for the parameters. A call whose result only goes through
+// an add or mul before being returned gets an accumulator PHI, and the
+// other returns fold the accumulator in.
+struct TailRecursion : public FunctionPass
+{
+	static char ID;
+	TailRecursion() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// A self call whose result is returned, either directly or as
+	// mAccumulate = (call op mOperand)
+	struct TailCall
+	{
+		llvm::CallInst* mCall;
+		llvm::BinaryOperator* mAccumulate;
+		llvm::Value* mOperand;
+		// Block holding the return, if the call's block branches to it
+		llvm::BasicBlock* mReturnBlock;
+	};
+	
+	static bool matchTailCall(llvm::CallInst* call, TailCall& site);
+	static llvm::BasicBlock* makeLoopHeader(llvm::Function& F);
+};
+
+// Declares the Sparse Conditional Constant Propagation Pass
+// (Wegman and Zadeck). Values are only evaluated along CFG edges
+// that can execute, so PHIs, chains of folds and constants guarded
+// by constant branches are all folded.
+struct SCCP : public FunctionPass
+{
+	static char ID;
+	SCCP() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// Lattice value of an SSA value
+	struct LatticeVal
+	{
+		enum State
+		{
+			// No executable definition seen yet
+			Unknown,
+			// Always this constant
+			Const,
+			// Not a constant
+			Overdefined
+		};
+		State mState = Unknown;
+		llvm::Constant* mConst = nullptr;
+	};
+	
+	LatticeVal getValue(llvm::Value* V);
+	void markConstant(llvm::Instruction* I, llvm::Constant* C);
+	void markOverdefined(llvm::Instruction* I);
+	void markBlockExecutable(llvm::BasicBlock* BB);
+	void markEdgeExecutable(llvm::BasicBlock* from, llvm::BasicBlock* to);
+	bool isEdgeExecutable(llvm::BasicBlock* from, llvm::BasicBlock* to) const;
+	void solve();
+	bool resolveUnknownBranches(llvm::Function& F);
+	
+	void visit(llvm::Instruction* I);
+	void visitPHI(llvm::PHINode* phi);
+	void visitTerminator(llvm::TerminatorInst* term);
+	
+	// Data for the current function
+	std::unordered_map<llvm::Value*, LatticeVal> mValues;
+	std::unordered_set<llvm::BasicBlock*> mExecutable;
+	std::set<std::pair<llvm::BasicBlock*, llvm::BasicBlock*>> mExecutableEdges;
+	std::vector<llvm::BasicBlock*> mBlockWorklist;
+	std::vector<llvm::Instruction*> mInstrWorklist;
+};
+
 // Declares the Constant Propagation Pass
 struct ConstantOps : public FunctionPass
 {
@@ -73,7 +204,92 @@ struct DeadBlocks : public FunctionPass
 	
 	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
 };
+
+// Jump threading -- when a block's branch is decided by PHI values
+// that are constant for some predecessors (the && and || diamonds),
+// those predecessors branch straight to the successor
+struct JumpThreading : public FunctionPass
+{
+	static char ID;
+	JumpThreading() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	bool isThreadable(llvm::BasicBlock* block);
+	llvm::BasicBlock* evaluate(llvm::BasicBlock* block, llvm::BasicBlock* pred);
+	bool threadBlock(llvm::BasicBlock* block);
+	
+	// Count for --opt-stats
+	unsigned mNumThreaded;
+};
+
+// Folds constants and constant branches, deletes unreachable blocks,
+// merges a block into its only predecessor and forwards blocks that
+// just branch on, until nothing changes. Before the loop passes it
+// keeps the preheaders they rely on.
+struct SimplifyCFG : public FunctionPass
+{
+	static char ID;
+	SimplifyCFG(bool keepPreheaders = true)
+	: FunctionPass(ID)
+	, mKeepPreheaders(keepPreheaders)
+	{}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	bool foldConstants(llvm::Function& F);
+	bool foldBranches(llvm::Function& F);
+	bool removeUnreachable(llvm::Function& F);
+	bool mergeIntoPredecessor(llvm::BasicBlock* block);
+	bool forwardBlock(llvm::BasicBlock* block);
+	
+	// Don't forward blocks into loop headers
+	bool mKeepPreheaders;
+	std::set<llvm::BasicBlock*> mLoopHeaders;
+	
+	// Counts for --opt-stats
+	unsigned mNumMerged;
+	unsigned mNumForwarded;
+};
+	
+// Global value numbering -- walks the dominator tree with a scoped
+// table of (opcode, type, flags, operands) expressions and replaces
+// each computation that a dominating one already made
+struct GVN : public FunctionPass
+{
+	static char ID;
+	GVN() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	struct Expression
+	{
+		unsigned mOpcode;
+		llvm::Type* mType;
+		// Compare predicate or the optional flags (nsw, exact, inbounds)
+		unsigned mExtra;
+		std::vector<llvm::Value*> mOperands;
+		
+		bool operator<(const Expression& rhs) const;
+	};
 	
+	static bool isNumberable(llvm::Instruction* I);
+	static Expression makeExpression(llvm::Instruction* I);
+	void processNode(llvm::DomTreeNode* node);
+	
+	// Expressions available in the current dominator tree scope
+	std::map<Expression, llvm::Instruction*> mAvailable;
+	
+	// Number of instructions removed in the current function
+	unsigned mNumRemoved;
+};
+
 // Loop invariant code motion
 struct LICM : public LoopPass
 {
@@ -88,6 +304,31 @@ struct LICM : public LoopPass
 	void hoistInstr(llvm::Instruction*);
     void hoistPreOrder(llvm::DomTreeNode*);
 
+	// Memory: loads whose address is invariant and not written in the
+	// loop are hoisted, and invariant addresses that are only accessed
+	// directly are promoted to registers with the store sunk to the exits
+	bool isSafeToHoistLoad(llvm::LoadInst*) const;
+	bool entersBody() const;
+	bool isGuaranteedToExecute(llvm::BasicBlock*) const;
+	bool isClobberedInLoop(llvm::Value* ptr, llvm::Type* type) const;
+	static bool mayAlias(llvm::Value* a, llvm::Type* aType,
+						 llvm::Value* b, llvm::Type* bType);
+	static bool isLocalObject(llvm::Value* obj);
+	void collectLoopWrites();
+	bool canPromote(llvm::Value* ptr, llvm::Type* type,
+					llvm::SmallVectorImpl<llvm::Instruction*>& uses) const;
+	void promoteStores();
+
+	// Instructions in the loop that may write memory
+	std::vector<llvm::Instruction*> mLoopWrites;
+
+	// The first test of the current loop always goes into the body
+	bool mEntersBody;
+
+	// Counts for --opt-stats
+	unsigned mNumHoistedLoads;
+	unsigned mNumPromoted;
+
 	// Data regarding the current loop
 	llvm::Loop* mCurrLoop;
 
@@ -100,6 +341,118 @@ struct LICM : public LoopPass
 	// Denotes whether or not loop has been modified
 	bool mChanged;
 };
+
+// Strength reduction of array addresses: each base[iv + C] in a loop,
+// where iv is an induction variable PHI, becomes a pointer PHI that
+// steps with iv, so the loop no longer extends and scales the index
+struct StrengthReduce : public LoopPass
+{
+	static char ID;
+	StrengthReduce() : LoopPass(ID) {}
+	
+	virtual bool runOnLoop(llvm::Loop* L, llvm::LPPassManager& LPM) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// base, iv and C of an address
+	typedef std::tuple<llvm::Value*, llvm::PHINode*, int64_t> AddressKey;
+	
+	bool matchIndex(llvm::Value* index, llvm::PHINode*& iv, int64_t& offset) const;
+	void reduce(const AddressKey& key, const std::vector<llvm::GetElementPtrInst*>& geps);
+	
+	// Data regarding the current loop
+	llvm::Loop* mCurrLoop;
+	
+	// Step of each induction variable of the current loop
+	std::map<llvm::PHINode*, int64_t> mSteps;
+	
+	// Number of pointer induction variables created
+	unsigned mNumReduced;
+};
+
+// Unrolls innermost while loops counted by an induction variable PHI.
+// Loops with a small constant trip count are unrolled completely; the
+// others run --unroll-count iterations per trip of a new loop, and the
+// original loop finishes the iterations that are left.
+struct LoopUnroll : public FunctionPass
+{
+	static char ID;
+	LoopUnroll() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// while (iv pred bound) { ...; iv += step; }
+	struct CountedLoop
+	{
+		llvm::PHINode* mIndVar;
+		llvm::Value* mStart;
+		llvm::Value* mBound;
+		int64_t mStep;
+		// Predicate under which the loop continues, with iv on the left
+		llvm::CmpInst::Predicate mPred;
+		llvm::BasicBlock* mBody;
+		llvm::BasicBlock* mExit;
+	};
+	
+	static bool analyzeLoop(llvm::Loop* L, CountedLoop& info);
+	// Step 1, (i < n or i <= n), one body block and a bare header
+	static bool isSimpleCountedLoop(llvm::Loop* L, const CountedLoop& info);
+	static int64_t constantTripCount(const CountedLoop& info, int64_t limit);
+	static unsigned loopSize(llvm::Loop* L);
+	void fullyUnroll(llvm::Loop* L, const CountedLoop& info, unsigned trips);
+	void partiallyUnroll(llvm::Loop* L, const CountedLoop& info, unsigned count);
+	
+	// Number of loops unrolled in the current function
+	unsigned mNumFull;
+	unsigned mNumPartial;
+};
+
+// Replaces counted loops that only fill an array with a constant, or
+// copy one array into another, with llvm.memset or llvm.memcpy
+struct LoopIdiom : public FunctionPass
+{
+	static char ID;
+	LoopIdiom() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// Returns the byte to fill with, or null if the store is no memset
+	static llvm::Value* memsetValue(llvm::StoreInst* store);
+	bool replaceLoop(llvm::Loop* L, const LoopUnroll::CountedLoop& info);
+	
+	// Number of loops replaced in the current function
+	unsigned mNumMemset;
+	unsigned mNumMemcpy;
+};
+
+// Vectorizes innermost counted loops whose body is one block of integer
+// arithmetic on a[i] accesses. A vector loop runs a vector's worth of
+// iterations per trip, and the original loop is the scalar epilogue.
+struct LoopVectorize : public FunctionPass
+{
+	static char ID;
+	LoopVectorize() : FunctionPass(ID) {}
+	
+	virtual bool runOnFunction(llvm::Function& F) override;
+	
+	virtual void getAnalysisUsage(llvm::AnalysisUsage& Info) const override;
+	
+	// narrowed is the char arithmetic that is done on i8 lanes
+	bool canVectorize(llvm::Loop* L, const LoopUnroll::CountedLoop& info,
+					  unsigned& width, std::set<llvm::Instruction*>& narrowed) const;
+	void vectorize(llvm::Loop* L, const LoopUnroll::CountedLoop& info,
+				   unsigned width, const std::set<llvm::Instruction*>& narrowed);
+	
+	// Bits in a vector register
+	unsigned mVectorBits;
+	
+	// Number of loops vectorized in the current function
+	unsigned mNumVectorized;
+};
 } // opt
 } // uscc
 
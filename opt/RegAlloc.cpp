@@ -22,11 +22,15 @@
 //  See LICENSE.TXT for details.
 //---------------------------------------------------------
 
+#include "InterferenceGraph.h"
+#include "RegAlloc.h"
+#include "RegAllocCommon.h"
 #include "llvm/CodeGen/Passes.h"
 #include "../lib/CodeGen/AllocationOrder.h"
 #include "../lib/CodeGen/LiveDebugVariables.h"
 #include "../lib/CodeGen/RegAllocBase.h"
 #include "../lib/CodeGen/Spiller.h"
+#include "../lib/CodeGen/SplitKit.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/CodeGen/CalcSpillWeights.h"
 #include "llvm/CodeGen/LiveIntervalAnalysis.h"
@@ -34,16 +38,24 @@
 #include "llvm/CodeGen/LiveRegMatrix.h"
 #include "llvm/CodeGen/LiveStackAnalysis.h"
 #include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineLoopInfo.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/PseudoSourceValue.h"
 #include "llvm/CodeGen/RegAllocRegistry.h"
 #include "llvm/CodeGen/VirtRegMap.h"
 #include "llvm/PassAnalysisSupport.h"
 #undef DEBUG
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetInstrInfo.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetRegisterInfo.h"
 #include <cstdlib>
@@ -51,21 +63,32 @@
 #include <vector>
 #include <unordered_map>
 #include <limits>
-#include <unordered_set>
-#include <iostream>
 #include <algorithm>
+#include <functional>
+#include <set>
 #include <stack>
 
 using namespace llvm;
+using uscc::opt::InterferenceGraph;
+using uscc::opt::gRegAllocOptions;
+using uscc::opt::LiveRangeSplitter;
+using uscc::opt::PhaseTimer;
+using uscc::opt::RegAllocOptions;
+using uscc::opt::SpillCodeCount;
 
 #define DEBUG_TYPE "regalloc"
 
+// Allocation trace for --regalloc-trace. It is written to the buffered
+// outs() stream and costs only a flag test when disabled.
+#define TRACE(X) do { if (gRegAllocOptions.trace) { X; } } while (false)
+
 static FunctionPass* createUSCCRegisterAllocator();
 
 static RegisterRegAlloc usccRegAlloc("uscc", "USCC register allocator",
 									  createUSCCRegisterAllocator);
 
-size_t NUM_COLORS = 4;
+size_t NUM_COLORS = 0;
+uscc::opt::RegAllocOptions uscc::opt::gRegAllocOptions;
 
 namespace {
 	struct CompSpillWeight {
@@ -78,19 +101,135 @@ namespace {
 namespace {
 	// PA7: Add any global members needed
 	
+	// Per-function numbers reported by --regalloc-stats
+	struct AllocStats {
+		// Size of the first interference graph
+		unsigned vregs = 0;
+		unsigned edges = 0;
+		unsigned maxDegree = 0;
+		// Select rounds (more than one when -O spills and rebuilds)
+		unsigned rounds = 0;
+		unsigned coalesced = 0;
+		unsigned spills = 0;
+		unsigned remats = 0;
+		unsigned splits = 0;
+		// Save/restore pairs around calls, and in the prologue/epilogue,
+		// avoided by the call-crossing aware color choice
+		unsigned callSavesAvoided = 0;
+		unsigned calleeSavesAvoided = 0;
+		// Spill slot loads and stores left in the function
+		unsigned reloads = 0;
+		unsigned spillStores = 0;
+		// Estimated frame size before and after spill slot coloring
+		uint64_t frameBefore = 0;
+		uint64_t frameAfter = 0;
+		unsigned slotsMerged = 0;
+		// Spill code removed by eliminateRedundantReloads
+		unsigned reloadsEliminated = 0;
+		unsigned spillStoresEliminated = 0;
+		// Seconds spent in each phase
+		double buildTime = 0;
+		double simplifyTime = 0;
+		double selectTime = 0;
+		double spillTime = 0;
+	};
+	
+	// (spill weight, node index) of a simplify spill candidate
+	typedef std::pair<float, unsigned> SpillCandidate;
+	
+	// A segment boundary of a virtual register's live interval, used by the
+	// sweep that builds the interference graph.
+	struct SegmentEvent {
+		SlotIndex index;
+		bool isStart;
+		// Dense virtual register index of the interval
+		unsigned node;
+		
+		SegmentEvent(SlotIndex idx, bool start, unsigned n)
+		: index(idx), isStart(start), node(n) {}
+		
+		bool operator<(const SegmentEvent &rhs) const {
+			if (index != rhs.index)
+				return index < rhs.index;
+			// Ends before starts at the same index
+			if (isStart != rhs.isStart)
+				return !isStart;
+			return node < rhs.node;
+		}
+	};
+	
 	/// RAUSCC allocator pass
 	class RAUSCC : public MachineFunctionPass, public RegAllocBase {
 		// context
 		MachineFunction *MF;
 		
 		// PA7: Add any member variables needed
-		std::unordered_map<LiveInterval *, std::unordered_set<LiveInterval *>> interferenceGraph;
+		// Nodes are keyed by TargetRegisterInfo::virtReg2Index
+		InterferenceGraph interferenceGraph;
 		std::stack<LiveInterval *> stack;
+		
+		// With -O, the graph as built for the current round (coalescing
+		// consumes interferenceGraph), and the nodes with a segment in each
+		// block, so the graph can be updated after a spill round instead of
+		// being built again
+		InterferenceGraph builtGraph;
+		std::vector<std::vector<unsigned>> blockNodes;
+		
+		// Iterated register coalescing state (George/Appel), only used when
+		// gRegAllocOptions.optimize is set. Node sets are tracked with a
+		// state per node plus ordered worklists, so ties break on the lowest
+		// register like simplifyGraph does.
+		enum NodeState {
+			NS_Simplify,
+			NS_Freeze,
+			NS_Spill,
+			NS_Coalesced,
+			NS_Stacked
+		};
+		enum MoveState {
+			MS_Worklist,
+			MS_Active,
+			MS_Coalesced,
+			MS_Constrained,
+			MS_Frozen
+		};
+		// A vreg-to-vreg COPY that is a candidate for coalescing
+		struct CopyMove {
+			unsigned dst;
+			unsigned src;
+			MoveState state;
+		};
+		std::vector<CopyMove> moves;
+		// Moves each node takes part in
+		std::vector<std::vector<unsigned>> moveList;
+		std::vector<NodeState> nodeState;
+		// Node each coalesced node was merged into
+		std::vector<unsigned> alias;
+		// Nodes that were merged into each node
+		std::vector<std::vector<unsigned>> coalescedMembers;
+		// Spill weight of each node, summed over merged nodes
+		std::vector<float> nodeWeight;
+		std::set<unsigned> simplifyWorklist;
+		std::set<unsigned> freezeWorklist;
+		std::set<unsigned> worklistMoves;
+		std::priority_queue<SpillCandidate, std::vector<SpillCandidate>,
+			std::greater<SpillCandidate>> spillWorklist;
+		
+		AllocStats Stats;
 
 		// state
 		std::unique_ptr<Spiller> SpillerInstance;
+		LiveRangeSplitter Splitter;
+		MachineLoopInfo *Loops;
+		const TargetInstrInfo *TII;
+		AliasAnalysis *AA;
+		
+		// Intervals created by splitting and spilling. Seeding enqueues
+		// every vreg too, but those are already on the simplify stack, so
+		// nothing is queued until allocation starts dequeuing.
 		std::priority_queue<LiveInterval*, std::vector<LiveInterval*>,
 			CompSpillWeight> Queue;
+		bool Seeded;
 			
 		// Scratch space.  Allocated here to avoid repeated malloc calls in
 		// selectOrSplit().
@@ -112,16 +251,27 @@ namespace {
 		Spiller &spiller() override { return *SpillerInstance; }
 			
 		void enqueue(LiveInterval *LI) override {
-		  Queue.push(LI);
+		  if (Seeded) {
+			  Queue.push(LI);
+		  }
 		}
 			
 		LiveInterval *dequeue() override {
-		  if (stack.empty()) {
-			  return nullptr;
+		  Seeded = true;
+		  if (!stack.empty()) {
+			  LiveInterval *LI = stack.top();
+			  stack.pop();
+			  return LI;
 		  }
-		  LiveInterval *LI = stack.top();
-		  stack.pop();
-		  return LI;
+		  // Then the intervals created by splitting and spilling
+		  while (!Queue.empty()) {
+			  LiveInterval *LI = Queue.top();
+			  Queue.pop();
+			  if (!VRM->hasPhys(LI->reg)) {
+				  return LI;
+			  }
+		  }
+		  return nullptr;
 		}
 			
 		unsigned selectOrSplit(LiveInterval &VirtReg,
@@ -136,8 +286,83 @@ namespace {
 		bool spillInterferences(LiveInterval &VirtReg, unsigned PhysReg,
 							  SmallVectorImpl<unsigned> &SplitVRegs);
 		
+		// Spill VirtReg through the inline spiller, which recomputes
+		// rematerializable defs at their uses instead of reloading them
+		void spillVirtReg(LiveInterval &VirtReg,
+						  SmallVectorImpl<unsigned> &NewVRegs);
+		bool isCheapRemat(const LiveInterval &VirtReg) const;
+		
 		void initGraph();
 		void simplifyGraph();
+		void addToBlocks(unsigned node, const LiveInterval &VirtReg);
+		void updateGraph();
+		
+		// Iterated register coalescing, used in place of simplifyGraph
+		void coalesceGraph();
+		void collectMoves();
+		void pushNode(unsigned node);
+		void decrementedDegree(unsigned node);
+		bool moveRelated(unsigned node) const;
+		void enableMoves(unsigned node);
+		void addWorkList(unsigned node);
+		void coalesceMove(unsigned move);
+		bool conservative(unsigned u, unsigned v) const;
+		void combine(unsigned u, unsigned v);
+		void freezeMoves(unsigned node);
+		unsigned getAlias(unsigned node) const;
+		
+		// Register of the node VirtReg was coalesced into, if it is free
+		unsigned coalescedPhysReg(LiveInterval &VirtReg);
+		
+		// Chaitin-Briggs select with optimistic coloring. The graph is
+		// rebuilt and colored again after each round of actual spills.
+		void allocateOptimistic();
+		void selectColors(SmallVectorImpl<LiveInterval *> &Spills);
+		unsigned selectColor(LiveInterval &VirtReg,
+							 SmallVectorImpl<LiveInterval *> &Spills);
+		
+		// Call-crossing aware color choice
+		unsigned saveCost(unsigned PhysReg) const;
+		void countSavesAvoided(const LiveInterval &VirtReg, bool CrossesCall,
+							   unsigned PhysReg, bool FreshCalleeSavedFree);
+		// Callee-saved registers and their aliases, and the ones that are
+		// assigned in the current select round
+		BitVector CalleeSaved;
+		BitVector UsedCalleeSaved;
+		
+		// Intervals assigned during the current select phase
+		std::vector<LiveInterval *> assigned;
+		
+		// Live range splitting before spilling (--split-mode)
+		bool trySplit(LiveInterval &VirtReg, SmallVectorImpl<unsigned> &NewVRegs);
+		MachineLoop *findSplitLoop(const LiveInterval &VirtReg) const;
+		bool canSplitAroundLoop(const LiveInterval &VirtReg,
+								const MachineLoop *L) const;
+		void splitAroundLoop(const LiveInterval &VirtReg, MachineLoop *L);
+		
+		// Let spill slots with disjoint lifetimes share storage
+		void colorSpillSlots();
+		void remapVirtStackSlots(const std::unordered_map<int, int> &Remap);
+		
+		// Turn reloads of values still held in a register into copies
+		void eliminateRedundantReloads();
+		void eliminateRedundantReloads(MachineBasicBlock &MBB);
+		
+		// --regalloc-stats and --regalloc-dump-graph
+		void recordGraph();
+		void printStats() const;
+		void dumpGraph() const;
+		
+		// Number of colors (K) of a node, from its register class
+		unsigned numColors(unsigned node) const;
+		unsigned classColors(const TargetRegisterClass *RC) const;
+		// Cached K of each register class, 0 until computed
+		mutable std::vector<unsigned> classColorCache;
+		
+		// Live interval of the graph node with the given index
+		LiveInterval *nodeInterval(unsigned node) const {
+			return &LIS->getInterval(TargetRegisterInfo::index2VirtReg(node));
+		}
 		static char ID;
 	};
 	
@@ -145,7 +370,8 @@ namespace {
 	
 } // end anonymous namespace
 
-RAUSCC::RAUSCC(): MachineFunctionPass(ID), interferenceGraph(), stack() {
+RAUSCC::RAUSCC(): MachineFunctionPass(ID), interferenceGraph(), stack(),
+	Loops(nullptr), TII(nullptr), AA(nullptr), Seeded(false) {
 	initializeLiveDebugVariablesPass(*PassRegistry::getPassRegistry());
 	initializeLiveIntervalsPass(*PassRegistry::getPassRegistry());
 	initializeSlotIndexesPass(*PassRegistry::getPassRegistry());
@@ -184,12 +410,31 @@ void RAUSCC::getAnalysisUsage(AnalysisUsage &AU) const {
 
 void RAUSCC::releaseMemory() {
 	SpillerInstance.reset();
+	Splitter.clear();
 	
 	// PA7: Delete any member data stored for each function
 	interferenceGraph.clear();
+	builtGraph.clear();
+	classColorCache.clear();
+	blockNodes.clear();
 	while (!stack.empty()) {
 		stack.pop();
 	}
+	Queue = decltype(Queue)();
+	moves.clear();
+	moveList.clear();
+	nodeState.clear();
+	alias.clear();
+	coalescedMembers.clear();
+	nodeWeight.clear();
+	simplifyWorklist.clear();
+	freezeWorklist.clear();
+	worklistMoves.clear();
+	while (!spillWorklist.empty()) {
+		spillWorklist.pop();
+	}
+	assigned.clear();
+	Stats = AllocStats();
 }
 
 
@@ -218,7 +463,7 @@ bool RAUSCC::spillInterferences(LiveInterval &VirtReg, unsigned PhysReg,
 	DEBUG(dbgs() << "spilling " << TRI->getName(PhysReg) <<
 		  " interferences with " << VirtReg << "\n");
 	assert(!Intfs.empty() && "expected interference");
-	std::cout << "Spilling "; std::cout.flush(); VirtReg.dump();
+	TRACE(outs() << "Spilling " << VirtReg << '\n');
 	// Spill each interfering vreg allocated to PhysReg or an alias.
 	for (unsigned i = 0, e = Intfs.size(); i != e; ++i) {
 		LiveInterval &Spill = *Intfs[i];
@@ -232,8 +477,37 @@ bool RAUSCC::spillInterferences(LiveInterval &VirtReg, unsigned PhysReg,
 		Matrix->unassign(Spill);
 		
 		// Spill the extracted interval.
-		LiveRangeEdit LRE(&Spill, SplitVRegs, *MF, *LIS, VRM);
-		spiller().spill(LRE);
+		spillVirtReg(Spill, SplitVRegs);
+	}
+	return true;
+}
+
+void RAUSCC::spillVirtReg(LiveInterval &VirtReg,
+						  SmallVectorImpl<unsigned> &NewVRegs) {
+	PhaseTimer T(Stats.spillTime);
+	if (uscc::opt::spillVirtReg(spiller(), VirtReg, NewVRegs, *MF, *LIS, *VRM))
+		++Stats.remats;
+	else
+		++Stats.spills;
+}
+
+// Returns true if every def of VirtReg is a single instruction as cheap as
+// a move that can be recomputed anywhere, e.g. constants and frame index
+// addresses of stack arrays.
+bool RAUSCC::isCheapRemat(const LiveInterval &VirtReg) const {
+	if (VirtReg.vni_begin() == VirtReg.vni_end())
+		return false;
+	for (LiveInterval::const_vni_iterator I = VirtReg.vni_begin(),
+		 E = VirtReg.vni_end(); I != E; ++I) {
+		const VNInfo *VNI = *I;
+		if (VNI->isUnused())
+			continue;
+		if (VNI->isPHIDef())
+			return false;
+		MachineInstr *MI = LIS->getInstructionFromIndex(VNI->def);
+		if (!MI || !MI->isAsCheapAsAMove() ||
+			!TII->isTriviallyReMaterializable(MI, AA))
+			return false;
 	}
 	return true;
 }
@@ -255,6 +529,12 @@ unsigned RAUSCC::selectOrSplit(LiveInterval &VirtReg,
 	// Populate a list of physical register spill candidates.
 	SmallVector<unsigned, 8> PhysRegSpillCands;
 	
+	// A coalesced vreg takes the register of the node it was merged into
+	if (unsigned PhysReg = coalescedPhysReg(VirtReg)) {
+		TRACE(outs() << "Assigning to physical register: " << VirtReg << '\n');
+		return PhysReg;
+	}
+	
 	// Check for an available register in this class.
 	AllocationOrder Order(VirtReg.reg, *VRM, RegClassInfo);
 	while (unsigned PhysReg = Order.next()) {
@@ -262,7 +542,7 @@ unsigned RAUSCC::selectOrSplit(LiveInterval &VirtReg,
 		switch (Matrix->checkInterference(VirtReg, PhysReg)) {
 			case LiveRegMatrix::IK_Free:
 				// PhysReg is available, allocate it.
-				std::cout << "Assigning to physical register: "; std::cout.flush(); VirtReg.dump();
+				TRACE(outs() << "Assigning to physical register: " << VirtReg << '\n');
 				return PhysReg;
 				
 			case LiveRegMatrix::IK_VirtReg:
@@ -288,13 +568,16 @@ unsigned RAUSCC::selectOrSplit(LiveInterval &VirtReg,
 		return *PhysRegI;
 	}
 	
-	// No other spill candidates were found, so spill the current VirtReg.
+	// No other spill candidates were found, so try to split the current
+	// VirtReg and otherwise spill it.
+	if (VirtReg.isSpillable() && trySplit(VirtReg, SplitVRegs))
+		return 0;
+	
 	DEBUG(dbgs() << "spilling: " << VirtReg << '\n');
-	std::cout << "Spilling "; std::cout.flush(); VirtReg.dump();
+	TRACE(outs() << "Spilling " << VirtReg << '\n');
 	if (!VirtReg.isSpillable())
 		return ~0u;
-	LiveRangeEdit LRE(&VirtReg, SplitVRegs, *MF, *LIS, VRM);
-	spiller().spill(LRE);
+	spillVirtReg(VirtReg, SplitVRegs);
 	
 	// The live virtual register requesting allocation was spilled, so tell
 	// the caller not to allocate anything during this round.
@@ -305,10 +588,9 @@ bool RAUSCC::runOnMachineFunction(MachineFunction &mf) {
 	DEBUG(dbgs() << "********** USCC REGISTER ALLOCATION **********\n"
 		  << "********** Function: "
 		  << mf.getName() << '\n');
-	std::cout << "********** USCC REGISTER ALLOCATION **********\n";
-	std::string funcName(mf.getName());
-	std::cout << "********** Function: " << funcName << '\n';
-	std::cout << "NUM_COLORS=" << NUM_COLORS << '\n';
+	TRACE(outs() << "********** USCC REGISTER ALLOCATION **********\n"
+		  << "********** Function: " << mf.getName() << '\n'
+		  << "NUM_COLORS=" << NUM_COLORS << '\n');
 	MF = &mf;
 	RegAllocBase::init(getAnalysis<VirtRegMap>(),
 					   getAnalysis<LiveIntervals>(),
@@ -319,11 +601,58 @@ bool RAUSCC::runOnMachineFunction(MachineFunction &mf) {
 								  getAnalysis<MachineBlockFrequencyInfo>());
 	
 	SpillerInstance.reset(createInlineSpiller(*this, *MF, *VRM));
+	Loops = &getAnalysis<MachineLoopInfo>();
+	TII = MF->getTarget().getInstrInfo();
+	AA = &getAnalysis<AliasAnalysis>();
+	Splitter.init(*MF, *LIS, *VRM, *Loops,
+				  getAnalysis<MachineDominatorTree>(),
+				  getAnalysis<MachineBlockFrequencyInfo>(),
+				  getAnalysis<LiveDebugVariables>());
+	
+	CalleeSaved.reset();
+	CalleeSaved.resize(TRI->getNumRegs());
+	for (const MCPhysReg *CSR = TRI->getCalleeSavedRegs(MF); *CSR; ++CSR) {
+		for (MCRegAliasIterator AI(*CSR, TRI, true); AI.isValid(); ++AI) {
+			CalleeSaved.set(*AI);
+		}
+	}
+	UsedCalleeSaved.reset();
+	UsedCalleeSaved.resize(TRI->getNumRegs());
 	
-	initGraph();
-	simplifyGraph();
+	if (gRegAllocOptions.optimize) {
+		allocateOptimistic();
+	} else {
+		{
+			PhaseTimer T(Stats.buildTime);
+			initGraph();
+		}
+		recordGraph();
+		{
+			PhaseTimer T(Stats.simplifyTime);
+			simplifyGraph();
+		}
+		double spillTime = Stats.spillTime;
+		{
+			PhaseTimer T(Stats.selectTime);
+			Seeded = false;
+			allocatePhysRegs();
+		}
+		// Spilling from selectOrSplit is counted in its own phase
+		Stats.selectTime -= Stats.spillTime - spillTime;
+		Stats.rounds = 1;
+	}
 	
-	allocatePhysRegs();
+	if (gRegAllocOptions.optimize) {
+		eliminateRedundantReloads();
+		colorSpillSlots();
+	}
+	
+	if (gRegAllocOptions.stats) {
+		SpillCodeCount Count = uscc::opt::countSpillCode(*MF);
+		Stats.reloads = Count.reloads;
+		Stats.spillStores = Count.spillStores;
+		printStats();
+	}
 	
 	// Diagnostic output before rewriting
 	DEBUG(dbgs() << "Post alloc VirtRegMap:\n" << *VRM << "\n");
@@ -333,10 +662,21 @@ bool RAUSCC::runOnMachineFunction(MachineFunction &mf) {
 }
 
 // Build an interference graph
+//
+// Rather than testing every pair of intervals with LiveInterval::overlaps,
+// this sweeps once over the segment start/end points in SlotIndex order.
+// Only intervals that are live at the same point are ever compared, so the
+// cost scales with the number of overlaps instead of the number of pairs.
 void RAUSCC::initGraph() {
 	// PA7: Implement
+	unsigned numVirtRegs = MRI->getNumVirtRegs();
+	interferenceGraph.reset(numVirtRegs);
+	std::vector<SegmentEvent> events;
+	if (gRegAllocOptions.optimize)
+		blockNodes.assign(MF->getNumBlockIDs(), std::vector<unsigned>());
+	
 	//Create a node for each virtual register
-	for (unsigned i = 0, e = MRI->getNumVirtRegs(); i != e; ++i) {
+	for (unsigned i = 0; i != numVirtRegs; ++i) {
 		// reg ID
 		unsigned Reg = TargetRegisterInfo::index2VirtReg(i);
 		// if is not a DEBUG register
@@ -344,109 +684,1234 @@ void RAUSCC::initGraph() {
 			continue;
 		// get the respective LiveInterval
 		LiveInterval *VirtReg = &LIS->getInterval(Reg);
-		interferenceGraph[VirtReg] = std::unordered_set<LiveInterval *>();
+		interferenceGraph.addNode(i);
+		if (gRegAllocOptions.optimize)
+			addToBlocks(i, *VirtReg);
+		
+		// Each segment contributes one start and one end event
+		for (LiveInterval::const_iterator SI = VirtReg->begin(),
+			 SE = VirtReg->end(); SI != SE; ++SI) {
+			events.push_back(SegmentEvent(SI->start, true, i));
+			events.push_back(SegmentEvent(SI->end, false, i));
+		}
 	}
-
-	// Iterate over all pairs of virtual registers
-	for (unsigned i = 0, e = MRI->getNumVirtRegs(); i != e; ++i) {
-		// reg ID
-		unsigned Reg1 = TargetRegisterInfo::index2VirtReg(i);
-		// if is not a DEBUG register
-		if (MRI->reg_nodbg_empty(Reg1))
+	
+	// Segments are half-open, so at the same index the ends sort before the
+	// starts and two segments that merely touch are not considered live
+	// at the same time.
+	std::sort(events.begin(), events.end());
+	
+	// Nodes with a segment live at the current sweep point. The position
+	// of each node in the vector is tracked so it can be removed in O(1).
+	std::vector<unsigned> active;
+	std::vector<unsigned> activePos(numVirtRegs, 0);
+	
+	for (const SegmentEvent &event : events) {
+		if (!event.isStart) {
+			// Swap the finished node with the back and drop it
+			unsigned pos = activePos[event.node];
+			unsigned last = active.back();
+			active[pos] = last;
+			activePos[last] = pos;
+			active.pop_back();
 			continue;
-		// get the respective LiveInterval
-		LiveInterval *VirtReg1 = &LIS->getInterval(Reg1);
-		for (unsigned j = 0; j != e; ++j) {
-			unsigned Reg2 = TargetRegisterInfo::index2VirtReg(j);
-			// if is not a DEBUG register
-			if (MRI->reg_nodbg_empty(Reg2))
-				continue;
-			// get the respective LiveInterval
-			LiveInterval *VirtReg2 = &LIS->getInterval(Reg2);
+		}
+		
+		// Everything still active overlaps the segment that starts here
+		for (unsigned other : active) {
+			interferenceGraph.addEdge(event.node, other);
+		}
+		activePos[event.node] = active.size();
+		active.push_back(event.node);
+	}
+}
+
+// K for a node is the number of registers of its class that can hold
+// values at the same time, capped by --num-colors (NUM_COLORS, 0 for no
+// cap). Registers that share a super-register count once (e.g. AL and AH
+// are both part of EAX), so a node of a class with aliasing registers is
+// not treated as colorable when its neighbors could block both halves.
+unsigned RAUSCC::numColors(unsigned node) const {
+	return classColors(MRI->getRegClass(TargetRegisterInfo::index2VirtReg(node)));
+}
 
-			// If the two virtual registers overlap, add an edge
-			if (Reg1 != Reg2 && VirtReg1->overlaps(*VirtReg2)) {
-				interferenceGraph[VirtReg1].insert(VirtReg2);
-				interferenceGraph[VirtReg2].insert(VirtReg1);
+unsigned RAUSCC::classColors(const TargetRegisterClass *RC) const {
+	if (classColorCache.empty())
+		classColorCache.assign(TRI->getNumRegClasses(), 0);
+	unsigned &K = classColorCache[RC->getID()];
+	if (K)
+		return K;
+	
+	BitVector Blocked(TRI->getNumRegs());
+	for (MCPhysReg PhysReg : RegClassInfo.getOrder(RC)) {
+		bool Clash = false;
+		for (MCRegAliasIterator AI(PhysReg, TRI, true); AI.isValid(); ++AI) {
+			if (Blocked.test(*AI)) {
+				Clash = true;
+				break;
 			}
 		}
+		if (Clash)
+			continue;
+		++K;
+		for (MCRegAliasIterator AI(PhysReg, TRI, true); AI.isValid(); ++AI) {
+			Blocked.set(*AI);
+		}
 	}
+	
+	if (NUM_COLORS && K > NUM_COLORS)
+		K = NUM_COLORS;
+	if (!K)
+		K = 1;
+	return K;
 }
 
+// Simplify the graph onto the stack.
+//
+// Nodes are kept in worklists that are updated as their neighbors are
+// removed, rather than rescanning the graph on every iteration:
+//  * lowDegree holds every node with degree < numColors, ordered by
+//    index so the lowest register is removed first
+//  * spillCandidates is a min-heap of the remaining nodes ordered by
+//    (weight, index). Entries for nodes that have since been removed are
+//    skipped lazily; when it is consulted lowDegree is empty, so every node
+//    still in the graph is a valid candidate.
 void RAUSCC::simplifyGraph() {
 	// PA7: Implement
+	unsigned numIndices = interferenceGraph.numIndices();
+	
+	std::set<unsigned> lowDegree;
+	std::priority_queue<SpillCandidate, std::vector<SpillCandidate>,
+		std::greater<SpillCandidate>> spillCandidates;
+	for (unsigned i = 0; i != numIndices; ++i) {
+		if (!interferenceGraph.hasNode(i))
+			continue;
+		if (interferenceGraph.degree(i) < numColors(i))
+			lowDegree.insert(i);
+		else
+			spillCandidates.push(SpillCandidate(nodeInterval(i)->weight, i));
+	}
 
     while (!interferenceGraph.empty()) {
+		unsigned node;
+		LiveInterval *VirtReg;
+		
 		//Try to find a trivially removable node
-        LiveInterval *trivialNode = nullptr;
-
-		unsigned minRegNum = UINT_MAX;
-		float minWeight = std::numeric_limits<float>::max();
-		for (const auto &pair : interferenceGraph) {
-            if (pair.second.size() < NUM_COLORS) {
-				if (pair.first->reg < minRegNum) {
-					trivialNode = pair.first;
-					minWeight = pair.first->weight;
-					minRegNum = pair.first->reg;
-				}      
-			}
+        if (!lowDegree.empty()) {
+			node = *lowDegree.begin();
+			lowDegree.erase(lowDegree.begin());
+			VirtReg = nodeInterval(node);
+			TRACE(outs() << "Found neighbors=" << interferenceGraph.degree(node)
+				  << " for " << *VirtReg << '\n');
+        } else {
+            // No trivially removable node nodes found; take the spill candidate
+			// with minimum (weight, regNum)
+			while (!interferenceGraph.hasNode(spillCandidates.top().second))
+				spillCandidates.pop();
+			node = spillCandidates.top().second;
+			spillCandidates.pop();
+			VirtReg = nodeInterval(node);
+
+			TRACE(outs() << "Spill candidate (neighbors=" << interferenceGraph.degree(node)
+				  << ", weight=" << format("%g", VirtReg->weight) << "): "
+				  << *VirtReg << '\n');
         }
+		
+		// Push the node onto the stack (spill candidates are marked for
+		// spilling later)
+		stack.push(VirtReg);
+		
+		// Remove this node from the graph, moving any neighbor that just
+		// became trivially colorable to the low degree worklist
+		interferenceGraph.removeNode(node);
+		for (unsigned neighbor : interferenceGraph.neighbors(node)) {
+			if (interferenceGraph.hasNode(neighbor) &&
+				interferenceGraph.degree(neighbor) + 1 == numColors(neighbor)) {
+				lowDegree.insert(neighbor);
+			}
+		}
+		TRACE(outs() << "Removal: " << *VirtReg << '\n');
+    }
+}
+
+// Record the blocks VirtReg has a segment in. Slot indexes increase in
+// layout order, so a segment covers the blocks from the one it starts in
+// up to the first block starting at or after its end.
+void RAUSCC::addToBlocks(unsigned node, const LiveInterval &VirtReg) {
+	SlotIndexes *Indexes = LIS->getSlotIndexes();
+	for (LiveInterval::const_iterator SI = VirtReg.begin(),
+		 SE = VirtReg.end(); SI != SE; ++SI) {
+		MachineFunction::iterator MBB(Indexes->getMBBFromIndex(SI->start));
+		for (; MBB != MF->end() && Indexes->getMBBStartIdx(MBB) < SI->end; ++MBB) {
+			std::vector<unsigned> &Nodes = blockNodes[MBB->getNumber()];
+			if (Nodes.empty() || Nodes.back() != node)
+				Nodes.push_back(node);
+		}
+	}
+}
 
-        if (trivialNode) {
-			std::cout << "Found neighbors=" << interferenceGraph[trivialNode].size() << " for "; 
-			std::cout.flush(); 
-			trivialNode->dump();
-            // Push the trivially removable node onto the stack
-            stack.push(trivialNode);
-
-            // Remove this node from the graph
-            std::unordered_set<LiveInterval *> neighbors = interferenceGraph[trivialNode];
-			for (LiveInterval *neighbor : neighbors) {
-				interferenceGraph[neighbor].erase(trivialNode);
+// Bring builtGraph up to date after a spill round. The spilled and split
+// intervals (and anything else the spiller left without uses) are erased,
+// and the spiller's new intervals, which are short ranges around single
+// uses, are added with edges to the nodes live in the blocks they touch.
+// Everything else keeps its edges: the spiller only ever shrinks other
+// intervals, so at worst an edge is stale, which is conservative.
+void RAUSCC::updateGraph() {
+	unsigned oldIndices = builtGraph.numIndices();
+	unsigned numVirtRegs = MRI->getNumVirtRegs();
+	builtGraph.grow(numVirtRegs);
+	
+	for (unsigned i = 0; i != oldIndices; ++i) {
+		unsigned Reg = TargetRegisterInfo::index2VirtReg(i);
+		if (builtGraph.hasNode(i) &&
+			(MRI->reg_nodbg_empty(Reg) || !LIS->hasInterval(Reg)))
+			builtGraph.eraseNode(i);
+	}
+	
+	for (unsigned i = oldIndices; i != numVirtRegs; ++i) {
+		unsigned Reg = TargetRegisterInfo::index2VirtReg(i);
+		if (MRI->reg_nodbg_empty(Reg) || !LIS->hasInterval(Reg))
+			continue;
+		LiveInterval *VirtReg = &LIS->getInterval(Reg);
+		builtGraph.addNode(i);
+		
+		SlotIndexes *Indexes = LIS->getSlotIndexes();
+		for (LiveInterval::const_iterator SI = VirtReg->begin(),
+			 SE = VirtReg->end(); SI != SE; ++SI) {
+			MachineFunction::iterator MBB(Indexes->getMBBFromIndex(SI->start));
+			for (; MBB != MF->end() && Indexes->getMBBStartIdx(MBB) < SI->end;
+				 ++MBB) {
+				for (unsigned other : blockNodes[MBB->getNumber()]) {
+					if (other != i && builtGraph.hasNode(other) &&
+						!builtGraph.hasEdge(i, other) &&
+						nodeInterval(other)->overlaps(SI->start, SI->end))
+						builtGraph.addEdge(i, other);
+				}
+			}
+		}
+		// Later new intervals are compared against this one too
+		addToBlocks(i, *VirtReg);
+	}
+}
+
+// Simplify the graph onto the stack with iterated register coalescing
+// (George and Appel). Move-related nodes are merged when the Briggs or
+// George test shows the merged node is still colorable, and moves are
+// frozen when neither simplify nor coalesce can make progress.
+void RAUSCC::coalesceGraph() {
+	unsigned numIndices = interferenceGraph.numIndices();
+	nodeState.assign(numIndices, NS_Stacked);
+	alias.resize(numIndices);
+	coalescedMembers.assign(numIndices, std::vector<unsigned>());
+	moveList.assign(numIndices, std::vector<unsigned>());
+	nodeWeight.assign(numIndices, 0.0f);
+	Stats.coalesced = 0;
+	simplifyWorklist.clear();
+	freezeWorklist.clear();
+	worklistMoves.clear();
+	while (!spillWorklist.empty()) {
+		spillWorklist.pop();
+	}
+	for (unsigned i = 0; i != numIndices; ++i) {
+		alias[i] = i;
+	}
+	
+	collectMoves();
+	
+	// Sort the nodes into the initial worklists
+	for (unsigned i = 0; i != numIndices; ++i) {
+		if (!interferenceGraph.hasNode(i))
+			continue;
+		// calculateSpillWeightsAndHints already halves the weight of
+		// rematerializable intervals. When the def is as cheap as a move,
+		// "reloading" costs no more than the copy it replaces, so those
+		// are made the preferred spill candidates.
+		nodeWeight[i] = nodeInterval(i)->weight;
+		if (isCheapRemat(*nodeInterval(i)))
+			nodeWeight[i] *= 0.5f;
+		if (interferenceGraph.degree(i) >= numColors(i)) {
+			nodeState[i] = NS_Spill;
+			spillWorklist.push(SpillCandidate(nodeWeight[i], i));
+		} else if (moveRelated(i)) {
+			nodeState[i] = NS_Freeze;
+			freezeWorklist.insert(i);
+		} else {
+			nodeState[i] = NS_Simplify;
+			simplifyWorklist.insert(i);
+		}
+	}
+	
+	while (!interferenceGraph.empty()) {
+		if (!simplifyWorklist.empty()) {
+			unsigned node = *simplifyWorklist.begin();
+			simplifyWorklist.erase(simplifyWorklist.begin());
+			TRACE(outs() << "Found neighbors=" << interferenceGraph.degree(node)
+				  << " for " << *nodeInterval(node) << '\n');
+			pushNode(node);
+		} else if (!worklistMoves.empty()) {
+			coalesceMove(*worklistMoves.begin());
+		} else if (!freezeWorklist.empty()) {
+			// Give up on coalescing the cheapest move-related node, the
+			// one with the lowest spill weight (lowest index on a tie)
+			unsigned node = *freezeWorklist.begin();
+			for (unsigned other : freezeWorklist) {
+				if (nodeWeight[other] < nodeWeight[node])
+					node = other;
+			}
+			freezeWorklist.erase(node);
+			nodeState[node] = NS_Simplify;
+			simplifyWorklist.insert(node);
+			freezeMoves(node);
+		} else {
+			// Pick the spill candidate with minimum (weight, regNum). Entries
+			// for nodes that left the spill worklist, or whose weight changed
+			// when another node was merged in, are stale.
+			SpillCandidate top = spillWorklist.top();
+			spillWorklist.pop();
+			unsigned node = top.second;
+			if (nodeState[node] != NS_Spill || nodeWeight[node] != top.first)
+				continue;
+			TRACE(outs() << "Spill candidate (neighbors=" << interferenceGraph.degree(node)
+				  << ", weight=" << format("%g", nodeWeight[node]) << "): "
+				  << *nodeInterval(node) << '\n');
+			freezeMoves(node);
+			pushNode(node);
+		}
+	}
+	
+}
+
+// Find the vreg-to-vreg copies that can be coalesced. Copies that
+// calculateSpillWeightsAndHints picked as a register hint are the most
+// frequently executed ones, so they are tried first.
+void RAUSCC::collectMoves() {
+	std::vector<CopyMove> hinted, unhinted;
+	for (MachineFunction::iterator MBB = MF->begin(), E = MF->end();
+		 MBB != E; ++MBB) {
+		for (MachineBasicBlock::iterator MI = MBB->begin(), ME = MBB->end();
+			 MI != ME; ++MI) {
+			if (!MI->isCopy())
+				continue;
+			const MachineOperand &Dst = MI->getOperand(0);
+			const MachineOperand &Src = MI->getOperand(1);
+			if (Dst.getSubReg() || Src.getSubReg())
+				continue;
+			unsigned DstReg = Dst.getReg();
+			unsigned SrcReg = Src.getReg();
+			if (DstReg == SrcReg ||
+				!TargetRegisterInfo::isVirtualRegister(DstReg) ||
+				!TargetRegisterInfo::isVirtualRegister(SrcReg))
+				continue;
+			// Merged nodes share one register, so they must share a class
+			if (MRI->getRegClass(DstReg) != MRI->getRegClass(SrcReg))
+				continue;
+			
+			unsigned dst = TargetRegisterInfo::virtReg2Index(DstReg);
+			unsigned src = TargetRegisterInfo::virtReg2Index(SrcReg);
+			if (!interferenceGraph.hasNode(dst) || !interferenceGraph.hasNode(src))
+				continue;
+			
+			CopyMove move = { dst, src, MS_Worklist };
+			if (MRI->getSimpleHint(DstReg) == SrcReg ||
+				MRI->getSimpleHint(SrcReg) == DstReg)
+				hinted.push_back(move);
+			else
+				unhinted.push_back(move);
+		}
+	}
+	
+	moves = hinted;
+	moves.insert(moves.end(), unhinted.begin(), unhinted.end());
+	for (unsigned i = 0, e = moves.size(); i != e; ++i) {
+		moveList[moves[i].dst].push_back(i);
+		moveList[moves[i].src].push_back(i);
+		worklistMoves.insert(i);
+	}
+}
+
+// Push a node (and every node merged into it) onto the stack and remove
+// it from the graph
+void RAUSCC::pushNode(unsigned node) {
+	nodeState[node] = NS_Stacked;
+	
+	// Merged nodes take the color of this node, so they are dequeued
+	// right after it
+	for (unsigned member : coalescedMembers[node]) {
+		stack.push(nodeInterval(member));
+	}
+	stack.push(nodeInterval(node));
+	
+	interferenceGraph.removeNode(node);
+	for (unsigned neighbor : interferenceGraph.neighbors(node)) {
+		if (interferenceGraph.hasNode(neighbor))
+			decrementedDegree(neighbor);
+	}
+	TRACE(outs() << "Removal: " << *nodeInterval(node) << '\n');
+}
+
+// Called after a neighbor of node left the graph. If node just became
+// trivially colorable, its moves (and its neighbors' moves) may now be
+// coalescable.
+void RAUSCC::decrementedDegree(unsigned node) {
+	if (nodeState[node] != NS_Spill ||
+		interferenceGraph.degree(node) >= numColors(node))
+		return;
+	
+	enableMoves(node);
+	for (unsigned neighbor : interferenceGraph.neighbors(node)) {
+		if (interferenceGraph.hasNode(neighbor))
+			enableMoves(neighbor);
+	}
+	
+	// The stale spill worklist entry is skipped when it is popped
+	if (moveRelated(node)) {
+		nodeState[node] = NS_Freeze;
+		freezeWorklist.insert(node);
+	} else {
+		nodeState[node] = NS_Simplify;
+		simplifyWorklist.insert(node);
+	}
+}
+
+bool RAUSCC::moveRelated(unsigned node) const {
+	for (unsigned move : moveList[node]) {
+		if (moves[move].state == MS_Active || moves[move].state == MS_Worklist)
+			return true;
+	}
+	return false;
+}
+
+void RAUSCC::enableMoves(unsigned node) {
+	for (unsigned move : moveList[node]) {
+		if (moves[move].state == MS_Active) {
+			moves[move].state = MS_Worklist;
+			worklistMoves.insert(move);
+		}
+	}
+}
+
+// Move a node that is no longer move-related and has low degree
+// from the freeze worklist to the simplify worklist
+void RAUSCC::addWorkList(unsigned node) {
+	if (nodeState[node] == NS_Freeze && !moveRelated(node) &&
+		interferenceGraph.degree(node) < numColors(node)) {
+		freezeWorklist.erase(node);
+		nodeState[node] = NS_Simplify;
+		simplifyWorklist.insert(node);
+	}
+}
+
+void RAUSCC::coalesceMove(unsigned move) {
+	worklistMoves.erase(move);
+	unsigned x = getAlias(moves[move].dst);
+	unsigned y = getAlias(moves[move].src);
+	
+	// The lower index is kept as the representative
+	unsigned u = std::min(x, y);
+	unsigned v = std::max(x, y);
+	
+	if (u == v) {
+		moves[move].state = MS_Coalesced;
+		++Stats.coalesced;
+		addWorkList(u);
+	} else if (interferenceGraph.hasEdge(u, v) ||
+			   !interferenceGraph.hasNode(u) || !interferenceGraph.hasNode(v)) {
+		// The two sides interfere, so this copy can never be removed
+		moves[move].state = MS_Constrained;
+		addWorkList(u);
+		addWorkList(v);
+	} else if (conservative(u, v)) {
+		moves[move].state = MS_Coalesced;
+		++Stats.coalesced;
+		TRACE(outs() << "Coalescing: " << *nodeInterval(v) << '\n'
+			  << "Into: " << *nodeInterval(u) << '\n');
+		combine(u, v);
+		addWorkList(u);
+	} else {
+		// Try again once a neighbor has been removed
+		moves[move].state = MS_Active;
+	}
+}
+
+// Merging u and v is safe if the merged node has fewer neighbors of
+// significant degree than it has colors (Briggs), or if every neighbor of v
+// already interferes with u or has insignificant degree (George).
+bool RAUSCC::conservative(unsigned u, unsigned v) const {
+	bool george = true;
+	for (unsigned t : interferenceGraph.neighbors(v)) {
+		if (interferenceGraph.hasNode(t) &&
+			interferenceGraph.degree(t) >= numColors(t) &&
+			!interferenceGraph.hasEdge(t, u)) {
+			george = false;
+			break;
+		}
+	}
+	if (george)
+		return true;
+	
+	std::set<unsigned> significant;
+	for (unsigned n : { u, v }) {
+		for (unsigned t : interferenceGraph.neighbors(n)) {
+			if (interferenceGraph.hasNode(t) &&
+				interferenceGraph.degree(t) >= numColors(t))
+				significant.insert(t);
+		}
+	}
+	return significant.size() < std::min(numColors(u), numColors(v));
+}
+
+// Merge v into u
+void RAUSCC::combine(unsigned u, unsigned v) {
+	if (nodeState[v] == NS_Freeze)
+		freezeWorklist.erase(v);
+	nodeState[v] = NS_Coalesced;
+	alias[v] = u;
+	moveList[u].insert(moveList[u].end(), moveList[v].begin(), moveList[v].end());
+	coalescedMembers[u].push_back(v);
+	coalescedMembers[u].insert(coalescedMembers[u].end(),
+							   coalescedMembers[v].begin(),
+							   coalescedMembers[v].end());
+	nodeWeight[u] += nodeWeight[v];
+	enableMoves(v);
+	
+	// Take over v's edges before v leaves the graph
+	for (unsigned t : interferenceGraph.neighbors(v)) {
+		if (interferenceGraph.hasNode(t))
+			interferenceGraph.addEdge(t, u);
+	}
+	interferenceGraph.removeNode(v);
+	for (unsigned t : interferenceGraph.neighbors(v)) {
+		if (interferenceGraph.hasNode(t))
+			decrementedDegree(t);
+	}
+	
+	if (nodeState[u] == NS_Freeze &&
+		interferenceGraph.degree(u) >= numColors(u)) {
+		freezeWorklist.erase(u);
+		nodeState[u] = NS_Spill;
+	}
+	if (nodeState[u] == NS_Spill) {
+		spillWorklist.push(SpillCandidate(nodeWeight[u], u));
+	}
+}
+
+// Give up on coalescing the moves of a node
+void RAUSCC::freezeMoves(unsigned node) {
+	for (unsigned move : moveList[node]) {
+		MoveState state = moves[move].state;
+		if (state != MS_Active && state != MS_Worklist)
+			continue;
+		worklistMoves.erase(move);
+		moves[move].state = MS_Frozen;
+		
+		unsigned other = getAlias(moves[move].dst);
+		if (other == getAlias(node))
+			other = getAlias(moves[move].src);
+		if (nodeState[other] == NS_Freeze && !moveRelated(other) &&
+			interferenceGraph.degree(other) < numColors(other)) {
+			freezeWorklist.erase(other);
+			nodeState[other] = NS_Simplify;
+			simplifyWorklist.insert(other);
+		}
+	}
+}
+
+unsigned RAUSCC::getAlias(unsigned node) const {
+	while (nodeState[node] == NS_Coalesced) {
+		node = alias[node];
+	}
+	return node;
+}
+
+// A coalesced vreg takes the register of the node it was merged into.
+// That node is dequeued first, so it has been assigned by now.
+unsigned RAUSCC::coalescedPhysReg(LiveInterval &VirtReg) {
+	unsigned Node = TargetRegisterInfo::virtReg2Index(VirtReg.reg);
+	if (Node >= alias.size() || getAlias(Node) == Node)
+		return 0;
+	
+	unsigned AliasReg = TargetRegisterInfo::index2VirtReg(getAlias(Node));
+	if (!VRM->hasPhys(AliasReg))
+		return 0;
+	unsigned PhysReg = VRM->getPhys(AliasReg);
+	if (Matrix->checkInterference(VirtReg, PhysReg) != LiveRegMatrix::IK_Free)
+		return 0;
+	return PhysReg;
+}
+
+// Build, coalesce/simplify and select until a round finishes without
+// actual spills. Nodes pushed as spill candidates are still colored
+// optimistically, and only the ones that really find no color are spilled.
+// Their spill code is then added to a fresh graph and every vreg is
+// colored again.
+void RAUSCC::allocateOptimistic() {
+	for (unsigned round = 1; ; ++round) {
+		{
+			PhaseTimer T(Stats.buildTime);
+			if (round == 1) {
+				initGraph();
+				builtGraph = interferenceGraph;
+			} else {
+				updateGraph();
+				interferenceGraph = builtGraph;
+			}
+		}
+		if (round == 1)
+			recordGraph();
+		{
+			PhaseTimer T(Stats.simplifyTime);
+			coalesceGraph();
+		}
+		
+		SmallVector<LiveInterval *, 8> Spills;
+		UsedCalleeSaved.reset();
+		Stats.callSavesAvoided = 0;
+		Stats.calleeSavesAvoided = 0;
+		{
+			PhaseTimer T(Stats.selectTime);
+			selectColors(Spills);
+		}
+		Stats.rounds = round;
+		if (Spills.empty())
+			break;
+		
+		TRACE(outs() << "Spill round " << round << ": " << Spills.size()
+			  << " actual spills\n");
+		
+		// The next round colors everything again around the spill code
+		for (LiveInterval *LI : assigned) {
+			Matrix->unassign(*LI);
+		}
+		assigned.clear();
+		
+		for (LiveInterval *LI : Spills) {
+			unsigned Reg = LI->reg;
+			SmallVector<unsigned, 4> NewVRegs;
+			if (!trySplit(*LI, NewVRegs)) {
+				TRACE(outs() << "Spilling " << *LI << '\n');
+				spillVirtReg(*LI, NewVRegs);
 			}
-            interferenceGraph.erase(trivialNode);
-			std::cout << "Removal: "; 
-			std::cout.flush(); 
-			trivialNode->dump();
-        } else {
-            // No trivially removable node nodes found; try to find a spill candidate
-            LiveInterval *spillNode = nullptr;
 			
-			minRegNum = UINT_MAX;
-			minWeight = std::numeric_limits<float>::max();
-			// Find the node with minimum (weight, regNum)
-			for(const auto &pair : interferenceGraph) {
-				if (pair.first->weight < minWeight) {
-					minWeight = pair.first->weight;
-					minRegNum = pair.first->reg;
-					spillNode = pair.first;
-				} else if (pair.first->weight == minWeight && pair.first->reg < minRegNum) {
-					minRegNum = pair.first->weight;
-					minRegNum = pair.first->reg;
-					spillNode = pair.first;
+			// Drop intervals that no longer have any uses
+			if (MRI->reg_nodbg_empty(Reg))
+				LIS->removeInterval(Reg);
+			for (unsigned NewReg : NewVRegs) {
+				if (MRI->reg_nodbg_empty(NewReg))
+					LIS->removeInterval(NewReg);
+			}
+		}
+	}
+	
+	TRACE(outs() << "Coalesced moves=" << Stats.coalesced
+		  << ", actual spills=" << Stats.spills
+		  << ", rematerialized=" << Stats.remats
+		  << ", splits=" << Stats.splits
+		  << ", call saves avoided=" << Stats.callSavesAvoided
+		  << ", callee saves avoided=" << Stats.calleeSavesAvoided << '\n');
+}
+
+// Pop the stack and give each node a color that none of its already
+// colored neighbors use. Colored neighbors are exactly the vregs already
+// assigned in the LiveRegMatrix, so a free physical register is one that
+// no colored neighbor (and no fixed register or call clobber) occupies.
+void RAUSCC::selectColors(SmallVectorImpl<LiveInterval *> &Spills) {
+	while (!stack.empty()) {
+		LiveInterval *VirtReg = stack.top();
+		stack.pop();
+		
+		// Unused registers can appear when the spiller coalesces snippets
+		if (MRI->reg_nodbg_empty(VirtReg->reg))
+			continue;
+		
+		// Invalidate all interference queries, assignments have changed
+		Matrix->invalidateVirtRegs();
+		if (unsigned PhysReg = selectColor(*VirtReg, Spills)) {
+			TRACE(outs() << "Assigning to physical register: " << *VirtReg << '\n');
+			Matrix->assign(*VirtReg, PhysReg);
+			assigned.push_back(VirtReg);
+		} else {
+			Spills.push_back(VirtReg);
+		}
+	}
+}
+
+// Returns the color for VirtReg, or 0 if it must be spilled.
+//
+// Only the first numColors registers of the class's allocation order are
+// colors. Intervals created by the spiller cannot be spilled again, so they
+// may use any register in the class, and if none is free they evict
+// spillable vregs that were colored earlier in this round.
+unsigned RAUSCC::selectColor(LiveInterval &VirtReg,
+							 SmallVectorImpl<LiveInterval *> &Spills) {
+	if (unsigned PhysReg = coalescedPhysReg(VirtReg))
+		return PhysReg;
+	
+	// A call the interval is live across clobbers every register that is
+	// not in UsableRegs. Those are left out of the colors, so an interval
+	// that crosses calls colors with the callee-saved registers instead of
+	// losing to the regmask on every caller-saved one.
+	bool CrossesCall = LIS->checkRegMaskInterference(VirtReg, UsableRegs);
+	SmallVector<unsigned, 16> Colors;
+	for (MCPhysReg PhysReg :
+		 RegClassInfo.getOrder(MRI->getRegClass(VirtReg.reg))) {
+		if (!CrossesCall || UsableRegs.test(PhysReg))
+			Colors.push_back(PhysReg);
+	}
+	// Short intervals take caller-saved colors first
+	std::stable_partition(Colors.begin(), Colors.end(), [this](unsigned R) {
+		return !CalleeSaved.test(R);
+	});
+	unsigned K = numColors(TargetRegisterInfo::virtReg2Index(VirtReg.reg));
+	if (VirtReg.isSpillable() && Colors.size() > K)
+		Colors.resize(K);
+	
+	// A free copy hint is taken right away (AllocationOrder tries them
+	// first). Otherwise the free color with the lowest save cost wins.
+	SmallVector<unsigned, 8> EvictCands;
+	unsigned Best = 0;
+	unsigned BestCost = ~0u;
+	bool FreshCalleeSavedFree = false;
+	AllocationOrder Order(VirtReg.reg, *VRM, RegClassInfo);
+	while (unsigned PhysReg = Order.next()) {
+		if (std::find(Colors.begin(), Colors.end(), PhysReg) == Colors.end())
+			continue;
+		switch (Matrix->checkInterference(VirtReg, PhysReg)) {
+			case LiveRegMatrix::IK_Free: {
+				unsigned Cost = saveCost(PhysReg);
+				if (Cost == 2)
+					FreshCalleeSavedFree = true;
+				if (Order.isHint()) {
+					countSavesAvoided(VirtReg, CrossesCall, PhysReg, false);
+					return PhysReg;
 				}
+				if (Cost < BestCost) {
+					Best = PhysReg;
+					BestCost = Cost;
+				}
+				continue;
+			}
+			case LiveRegMatrix::IK_VirtReg:
+				EvictCands.push_back(PhysReg);
+				continue;
+			default:
+				// RegMask or RegUnit interference.
+				continue;
+		}
+	}
+	
+	if (Best) {
+		countSavesAvoided(VirtReg, CrossesCall, Best, FreshCalleeSavedFree);
+		return Best;
+	}
+	
+	if (VirtReg.isSpillable())
+		return 0;
+	
+	// Make room for an unspillable interval by evicting colored vregs
+	for (unsigned PhysReg : EvictCands) {
+		SmallVector<LiveInterval *, 8> Intfs;
+		bool CanEvict = true;
+		for (MCRegUnitIterator Units(PhysReg, TRI); Units.isValid() && CanEvict;
+			 ++Units) {
+			LiveIntervalUnion::Query &Q = Matrix->query(VirtReg, *Units);
+			Q.collectInterferingVRegs();
+			if (Q.seenUnspillableVReg()) {
+				CanEvict = false;
+				break;
 			}
+			for (LiveInterval *Intf : Q.interferingVRegs()) {
+				Intfs.push_back(Intf);
+			}
+		}
+		if (!CanEvict)
+			continue;
+		
+		for (LiveInterval *Intf : Intfs) {
+			// Skip duplicates
+			if (!VRM->hasPhys(Intf->reg))
+				continue;
+			Matrix->unassign(*Intf);
+			assigned.erase(std::find(assigned.begin(), assigned.end(), Intf));
+			Spills.push_back(Intf);
+		}
+		return PhysReg;
+	}
+	
+	report_fatal_error("ran out of registers during register allocation");
+}
+
+// What assigning PhysReg adds to the save and restore code: nothing for a
+// caller-saved register (calls it is live across were already left out),
+// 1 for a callee-saved register the prologue saves anyway, and 2 for one
+// that would need a new save in the prologue and restore in the epilogue
+unsigned RAUSCC::saveCost(unsigned PhysReg) const {
+	if (!CalleeSaved.test(PhysReg))
+		return 0;
+	return UsedCalleeSaved.test(PhysReg) ? 1 : 2;
+}
+
+// Count the save/restore pairs the choice of PhysReg avoided. A value in a
+// callee-saved register is not saved and restored around each call it is
+// live across, and a short value in a caller-saved register leaves an
+// unused callee-saved register out of the prologue and epilogue.
+void RAUSCC::countSavesAvoided(const LiveInterval &VirtReg, bool CrossesCall,
+							   unsigned PhysReg, bool FreshCalleeSavedFree) {
+	if (CrossesCall) {
+		ArrayRef<SlotIndex> Calls = LIS->getRegMaskSlots();
+		for (const SlotIndex *I = std::lower_bound(Calls.begin(), Calls.end(),
+												   VirtReg.beginIndex());
+			 I != Calls.end() && *I < VirtReg.endIndex(); ++I) {
+			if (VirtReg.liveAt(*I))
+				++Stats.callSavesAvoided;
+		}
+	} else if (FreshCalleeSavedFree && !CalleeSaved.test(PhysReg)) {
+		++Stats.calleeSavesAvoided;
+	}
+	
+	if (CalleeSaved.test(PhysReg)) {
+		for (MCRegAliasIterator AI(PhysReg, TRI, true); AI.isValid(); ++AI) {
+			UsedCalleeSaved.set(*AI);
+		}
+	}
+}
+
+// Try to split VirtReg instead of spilling all of it, according to
+// --split-mode. On success the new intervals are appended to NewVRegs and
+// VirtReg is left without uses.
+//
+//  loop:   the part of VirtReg inside the innermost loop with a use is
+//          given its own interval, so the rest is spilled around the
+//          loop rather than inside it
+//  region: each block with uses gets a local interval (as in
+//          RAGreedy::tryBlockSplit), so only the live-through parts
+//          are spilled
+bool RAUSCC::trySplit(LiveInterval &VirtReg,
+					  SmallVectorImpl<unsigned> &NewVRegs) {
+	RegAllocOptions::SplitMode Mode = gRegAllocOptions.splitMode;
+	if (Mode == RegAllocOptions::SplitNone)
+		return false;
+	PhaseTimer T(Stats.spillTime);
+	
+	bool Split;
+	if (Mode == RegAllocOptions::SplitLoop) {
+		MachineLoop *L = nullptr;
+		Split = Splitter.split(VirtReg, NewVRegs,
+			[&]() { L = findSplitLoop(VirtReg); return L != nullptr; },
+			[&]() { splitAroundLoop(VirtReg, L); });
+	} else {
+		Split = Splitter.splitBlocks(VirtReg, NewVRegs);
+	}
+	if (Split)
+		++Stats.splits;
+	return Split;
+}
+
+// Find the innermost loop with a use of VirtReg that it can be split
+// around, walking outwards from the deepest use
+MachineLoop *RAUSCC::findSplitLoop(const LiveInterval &VirtReg) const {
+	MachineLoop *Best = nullptr;
+	for (const SplitAnalysis::BlockInfo &BI : Splitter.analysis().getUseBlocks()) {
+		MachineLoop *L = Loops->getLoopFor(BI.MBB);
+		if (L && (!Best || L->getLoopDepth() > Best->getLoopDepth()))
+			Best = L;
+	}
+	
+	for (; Best; Best = Best->getParentLoop()) {
+		if (canSplitAroundLoop(VirtReg, Best))
+			return Best;
+	}
+	return nullptr;
+}
+
+// The loop interval is entered with a copy at the end of the preheader
+// and left with a copy at the top of each exit block where VirtReg is
+// live. That needs a preheader the value is live out of, and exit blocks
+// that are only reached from inside the loop.
+bool RAUSCC::canSplitAroundLoop(const LiveInterval &VirtReg,
+								const MachineLoop *L) const {
+	MachineBasicBlock *Preheader = L->getLoopPreheader();
+	if (!Preheader || !LIS->isLiveOutOfMBB(VirtReg, Preheader))
+		return false;
+	
+	SmallVector<MachineBasicBlock *, 8> Exits;
+	L->getExitBlocks(Exits);
+	for (MachineBasicBlock *Exit : Exits) {
+		if (!LIS->isLiveInToMBB(VirtReg, Exit))
+			continue;
+		for (MachineBasicBlock::pred_iterator PI = Exit->pred_begin(),
+			 PE = Exit->pred_end(); PI != PE; ++PI) {
+			if (!L->contains(*PI))
+				return false;
+		}
+	}
+	return true;
+}
+
+void RAUSCC::splitAroundLoop(const LiveInterval &VirtReg, MachineLoop *L) {
+	SplitEditor &SE = Splitter.editor();
+	SE.openIntv();
+	SE.enterIntvAtEnd(*L->getLoopPreheader());
+	for (MachineBasicBlock *MBB : L->getBlocks()) {
+		SE.useIntv(*MBB);
+	}
+	
+	SmallVector<MachineBasicBlock *, 8> Exits;
+	SmallPtrSet<MachineBasicBlock *, 8> Visited;
+	L->getExitBlocks(Exits);
+	for (MachineBasicBlock *Exit : Exits) {
+		if (Visited.insert(Exit) && LIS->isLiveInToMBB(VirtReg, Exit))
+			SE.leaveIntvAtTop(*Exit);
+	}
+}
 
-			std::cout << "Spill candidate (neighbors=" << interferenceGraph[spillNode].size() 
-				<< ", weight=" << spillNode->weight << "): "; 
-			std::cout.flush(); 
-			spillNode->dump();
+// Record the size of the interference graph, and dump it if requested
+void RAUSCC::recordGraph() {
+	Stats.vregs = interferenceGraph.numNodes();
+	Stats.edges = interferenceGraph.numEdges();
+	Stats.maxDegree = 0;
+	for (unsigned i = 0, e = interferenceGraph.numIndices(); i != e; ++i) {
+		if (interferenceGraph.hasNode(i))
+			Stats.maxDegree = std::max(Stats.maxDegree, interferenceGraph.degree(i));
+	}
+	
+	if (gRegAllocOptions.graphDump != RegAllocOptions::DumpNone)
+		dumpGraph();
+}
 
-            // Push the spill candidate onto the stack (marked for spilling later)
-            stack.push(spillNode);
+// Block-local forward availability of spill slot values. The inline
+// spiller reloads before every use, so straight-line code often reloads a
+// slot right after storing the same register to it, or reloads the same
+// slot twice in a row. While the register that was stored or loaded has
+// not been clobbered, a later reload of the slot is replaced by a copy from
+// that register (the rewriter drops it if both got the same register), and
+// a store of that register back to the slot is dropped.
+//
+// This runs after assignment but before the rewriter, so the source vreg's
+// interval is extended to the copy. No def of its register comes between,
+// and any other vreg in that register would have to be live across the
+// original store or load, so the extension cannot create interference.
+void RAUSCC::eliminateRedundantReloads() {
+	for (MachineFunction::iterator MBB = MF->begin(), E = MF->end();
+		 MBB != E; ++MBB) {
+		eliminateRedundantReloads(*MBB);
+	}
+	TRACE(outs() << "Reloads eliminated=" << Stats.reloadsEliminated
+		  << ", spill stores eliminated=" << Stats.spillStoresEliminated << '\n');
+}
 
-            // Remove the spill candidate from the graph
-            std::unordered_set<LiveInterval *> neighbors = interferenceGraph[spillNode];
-			for (LiveInterval *neighbor : neighbors) {
-				interferenceGraph[neighbor].erase(spillNode);
+void RAUSCC::eliminateRedundantReloads(MachineBasicBlock &MBB) {
+	const MachineFrameInfo *MFI = MF->getFrameInfo();
+	// Spill slot -> vreg known to hold the same value
+	std::unordered_map<int, unsigned> Avail;
+	
+	for (MachineBasicBlock::iterator I = MBB.begin(), E = MBB.end(); I != E; ) {
+		MachineInstr *MI = I++;
+		if (MI->isDebugValue())
+			continue;
+		
+		int FI;
+		unsigned LoadReg = TII->isLoadFromStackSlot(MI, FI);
+		unsigned StoreReg = 0;
+		if (!LoadReg)
+			StoreReg = TII->isStoreToStackSlot(MI, FI);
+		if ((LoadReg || StoreReg) && !MFI->isSpillSlotObjectIndex(FI))
+			LoadReg = StoreReg = 0;
+		if (!TargetRegisterInfo::isVirtualRegister(LoadReg) ||
+			!VRM->hasPhys(LoadReg))
+			LoadReg = 0;
+		if (!TargetRegisterInfo::isVirtualRegister(StoreReg) ||
+			!VRM->hasPhys(StoreReg))
+			StoreReg = 0;
+		
+		std::unordered_map<int, unsigned>::iterator A =
+			(LoadReg || StoreReg) ? Avail.find(FI) : Avail.end();
+		
+		if (StoreReg && A != Avail.end() && A->second == StoreReg) {
+			// The slot already holds this value
+			LIS->RemoveMachineInstrFromMaps(MI);
+			MI->eraseFromParent();
+			++Stats.spillStoresEliminated;
+			continue;
+		}
+		
+		if (LoadReg && A != Avail.end() && A->second != LoadReg &&
+			MRI->getRegClass(A->second)->getSize() ==
+			MRI->getRegClass(LoadReg)->getSize()) {
+			unsigned SrcReg = A->second;
+			MachineInstr *Copy = BuildMI(MBB, MI, MI->getDebugLoc(),
+										 TII->get(TargetOpcode::COPY), LoadReg)
+				.addReg(SrcReg);
+			LIS->ReplaceMachineInstrInMaps(MI, Copy);
+			MI->eraseFromParent();
+			MI = Copy;
+			
+			LiveInterval &SrcLI = LIS->getInterval(SrcReg);
+			unsigned SrcPhys = VRM->getPhys(SrcReg);
+			Matrix->unassign(SrcLI);
+			LIS->extendToIndices(SrcLI, LIS->getInstructionIndex(Copy).getRegSlot());
+			MRI->clearKillFlags(SrcReg);
+			assert(Matrix->checkInterference(SrcLI, SrcPhys) == LiveRegMatrix::IK_Free &&
+				   "Interference after extending a reload source");
+			Matrix->assign(SrcLI, SrcPhys);
+			++Stats.reloadsEliminated;
+		}
+		
+		// Forget values whose register this instruction clobbers, and slots
+		// it may write to some other way (e.g. a folded memory operand)
+		for (const MachineOperand &MO : MI->operands()) {
+			if (MO.isFI() && !StoreReg && MI->mayStore()) {
+				Avail.erase(MO.getIndex());
+				continue;
+			}
+			if (!MO.isRegMask() && !(MO.isReg() && MO.isDef() && MO.getReg()))
+				continue;
+			for (std::unordered_map<int, unsigned>::iterator V = Avail.begin();
+				 V != Avail.end(); ) {
+				unsigned Phys = VRM->getPhys(V->second);
+				bool Clobbered;
+				if (MO.isRegMask()) {
+					Clobbered = MO.clobbersPhysReg(Phys);
+				} else {
+					unsigned Def = MO.getReg();
+					if (TargetRegisterInfo::isVirtualRegister(Def))
+						Def = VRM->hasPhys(Def) ? VRM->getPhys(Def) : 0;
+					Clobbered = MO.getReg() == V->second ||
+						(Def && TRI->regsOverlap(Def, Phys));
+				}
+				if (Clobbered)
+					V = Avail.erase(V);
+				else
+					++V;
 			}
+		}
+		
+		if (LoadReg)
+			Avail[FI] = LoadReg;
+		else if (StoreReg)
+			Avail[FI] = StoreReg;
+	}
+}
 
-            interferenceGraph.erase(spillNode);
-			std::cout << "Removal: "; 
-			std::cout.flush(); 
-			spillNode->dump();
-        }
-    }
+// Color the spill slots by their LiveStacks intervals, first fit in order
+// of the slot's first use. A slot whose lifetime is disjoint from every
+// slot already given a color is folded into it and removed from the frame.
+//
+// LLVM's StackSlotColoring still runs after the rewriter. Doing it here
+// means the frame the allocator leaves behind is already compact, and lets
+// the stats report what the allocator's spills cost in frame size.
+void RAUSCC::colorSpillSlots() {
+	LiveStacks &LS = getAnalysis<LiveStacks>();
+	MachineFrameInfo *MFI = MF->getFrameInfo();
+	Stats.frameBefore = MFI->estimateStackSize(*MF);
+	
+	std::vector<std::pair<int, LiveInterval *>> Slots;
+	for (LiveStacks::iterator I = LS.begin(), E = LS.end(); I != E; ++I) {
+		int FI = I->first;
+		if (MFI->isSpillSlotObjectIndex(FI) && !MFI->isDeadObjectIndex(FI) &&
+			!I->second.empty())
+			Slots.push_back(std::make_pair(FI, &I->second));
+	}
+	std::sort(Slots.begin(), Slots.end(),
+			  [](const std::pair<int, LiveInterval *> &A,
+				 const std::pair<int, LiveInterval *> &B) {
+				  if (A.second->beginIndex() != B.second->beginIndex())
+					  return A.second->beginIndex() < B.second->beginIndex();
+				  return A.first < B.first;
+			  });
+	
+	// Each color is a slot whose interval is the union of its members
+	std::vector<std::pair<int, LiveInterval *>> Colors;
+	std::unordered_map<int, int> Remap;
+	for (const std::pair<int, LiveInterval *> &Slot : Slots) {
+		std::pair<int, LiveInterval *> *Color = nullptr;
+		for (std::pair<int, LiveInterval *> &C : Colors) {
+			if (!C.second->overlaps(*Slot.second)) {
+				Color = &C;
+				break;
+			}
+		}
+		if (!Color) {
+			Colors.push_back(Slot);
+			continue;
+		}
+		
+		int FI = Slot.first;
+		int NewFI = Color->first;
+		Color->second->MergeSegmentsInAsValue(*Slot.second,
+											  Color->second->getValNumInfo(0));
+		if (MFI->getObjectSize(FI) > MFI->getObjectSize(NewFI))
+			MFI->setObjectSize(NewFI, MFI->getObjectSize(FI));
+		if (MFI->getObjectAlignment(FI) > MFI->getObjectAlignment(NewFI))
+			MFI->setObjectAlignment(NewFI, MFI->getObjectAlignment(FI));
+		Remap[FI] = NewFI;
+	}
+	
+	if (!Remap.empty()) {
+		for (MachineFunction::iterator MBB = MF->begin(), E = MF->end();
+			 MBB != E; ++MBB) {
+			for (MachineBasicBlock::iterator MI = MBB->begin(), ME = MBB->end();
+				 MI != ME; ++MI) {
+				for (MachineOperand &MO : MI->operands()) {
+					if (!MO.isFI())
+						continue;
+					std::unordered_map<int, int>::iterator R = Remap.find(MO.getIndex());
+					if (R != Remap.end())
+						MO.setIndex(R->second);
+				}
+				for (MachineInstr::mmo_iterator MMO = MI->memoperands_begin(),
+					 MMOE = MI->memoperands_end(); MMO != MMOE; ++MMO) {
+					const FixedStackPseudoSourceValue *FSV =
+						dyn_cast_or_null<FixedStackPseudoSourceValue>((*MMO)->getPseudoValue());
+					if (!FSV)
+						continue;
+					std::unordered_map<int, int>::iterator R = Remap.find(FSV->getFrameIndex());
+					if (R != Remap.end())
+						(*MMO)->setValue(PseudoSourceValue::getFixedStack(R->second));
+				}
+			}
+		}
+		
+		remapVirtStackSlots(Remap);
+		for (const std::pair<const int, int> &R : Remap) {
+			LS.getInterval(R.first).clear();
+			MFI->RemoveStackObject(R.first);
+		}
+	}
+	
+	Stats.slotsMerged = Remap.size();
+	Stats.frameAfter = MFI->estimateStackSize(*MF);
+	TRACE(outs() << "Spill slots merged=" << Stats.slotsMerged
+		  << ", frame size " << Stats.frameBefore << " -> "
+		  << Stats.frameAfter << '\n');
+}
+
+// Point the VirtRegMap entries of merged slots at their color, so the
+// rewriter's debug values and the map's dump don't name removed frame
+// indices. assignVirt2StackSlot only accepts a vreg without a slot, so
+// the map is reset and every assignment is made again.
+void RAUSCC::remapVirtStackSlots(const std::unordered_map<int, int> &Remap) {
+	struct VirtAssignment {
+		unsigned Reg;
+		unsigned PhysReg;
+		int StackSlot;
+		unsigned PreSplitReg;
+	};
+	std::vector<VirtAssignment> Assignments;
+	bool Remapped = false;
+	for (unsigned i = 0, e = MRI->getNumVirtRegs(); i != e; ++i) {
+		unsigned Reg = TargetRegisterInfo::index2VirtReg(i);
+		VirtAssignment A = { Reg, VRM->getPhys(Reg), VRM->getStackSlot(Reg),
+			VRM->getPreSplitReg(Reg) };
+		std::unordered_map<int, int>::const_iterator R = Remap.find(A.StackSlot);
+		if (R != Remap.end()) {
+			A.StackSlot = R->second;
+			Remapped = true;
+		}
+		Assignments.push_back(A);
+	}
+	if (!Remapped)
+		return;
+	
+	VRM->runOnMachineFunction(*MF);
+	for (const VirtAssignment &A : Assignments) {
+		if (A.PhysReg != VirtRegMap::NO_PHYS_REG)
+			VRM->assignVirt2Phys(A.Reg, A.PhysReg);
+		if (A.StackSlot != VirtRegMap::NO_STACK_SLOT)
+			VRM->assignVirt2StackSlot(A.Reg, A.StackSlot);
+		if (A.PreSplitReg)
+			VRM->setIsSplitFromReg(A.Reg, A.PreSplitReg);
+	}
+}
+
+// Print one JSON object (on one line) for this function
+void RAUSCC::printStats() const {
+	outs() << "{\"function\": \"" << MF->getName() << "\""
+		<< ", \"allocator\": \"coloring\""
+		<< ", \"vregs\": " << Stats.vregs
+		<< ", \"edges\": " << Stats.edges
+		<< ", \"max_degree\": " << Stats.maxDegree
+		<< ", \"rounds\": " << Stats.rounds
+		<< ", \"coalesced_moves\": " << Stats.coalesced
+		<< ", \"spills\": " << Stats.spills
+		<< ", \"rematerialized\": " << Stats.remats
+		<< ", \"splits\": " << Stats.splits
+		<< ", \"call_saves_avoided\": " << Stats.callSavesAvoided
+		<< ", \"callee_saves_avoided\": " << Stats.calleeSavesAvoided
+		<< ", \"reloads\": " << Stats.reloads
+		<< ", \"spill_stores\": " << Stats.spillStores
+		<< ", \"reloads_eliminated\": " << Stats.reloadsEliminated
+		<< ", \"spill_stores_eliminated\": " << Stats.spillStoresEliminated
+		<< ", \"slots_merged\": " << Stats.slotsMerged
+		<< ", \"frame_before\": " << Stats.frameBefore
+		<< ", \"frame_after\": " << Stats.frameAfter
+		<< ", \"time\": {"
+		<< "\"build\": " << format("%.6f", Stats.buildTime)
+		<< ", \"simplify\": " << format("%.6f", Stats.simplifyTime)
+		<< ", \"select\": " << format("%.6f", Stats.selectTime)
+		<< ", \"spill\": " << format("%.6f", Stats.spillTime)
+		<< "}}\n";
+}
+
+// Write the interference graph as built (before any coalescing) to
+// <prefix>.<function>.dot or .json
+void RAUSCC::dumpGraph() const {
+	bool Dot = gRegAllocOptions.graphDump == RegAllocOptions::DumpDot;
+	std::string FileName = gRegAllocOptions.graphDumpPrefix + "." +
+		MF->getName().str() + (Dot ? ".dot" : ".json");
+	std::string Error;
+	raw_fd_ostream File(FileName.c_str(), Error, sys::fs::F_Text);
+	if (!Error.empty()) {
+		errs() << "uscc: error: Unable to write " << FileName << ": " << Error << '\n';
+		return;
+	}
+	
+	unsigned numIndices = interferenceGraph.numIndices();
+	if (Dot) {
+		File << "graph \"" << MF->getName() << "\" {\n";
+		for (unsigned i = 0; i != numIndices; ++i) {
+			if (!interferenceGraph.hasNode(i))
+				continue;
+			File << "\tn" << i << " [label=\""
+				<< PrintReg(TargetRegisterInfo::index2VirtReg(i))
+				<< "\\nweight=" << format("%g", nodeInterval(i)->weight)
+				<< "\"];\n";
+		}
+		for (unsigned i = 0; i != numIndices; ++i) {
+			if (!interferenceGraph.hasNode(i))
+				continue;
+			for (unsigned n : interferenceGraph.neighbors(i)) {
+				if (i < n)
+					File << "\tn" << i << " -- n" << n << ";\n";
+			}
+		}
+		File << "}\n";
+		return;
+	}
+	
+	File << "{\"function\": \"" << MF->getName() << "\", \"nodes\": [";
+	bool First = true;
+	for (unsigned i = 0; i != numIndices; ++i) {
+		if (!interferenceGraph.hasNode(i))
+			continue;
+		File << (First ? "" : ", ") << "{\"index\": " << i
+			<< ", \"reg\": \"" << PrintReg(TargetRegisterInfo::index2VirtReg(i))
+			<< "\", \"weight\": " << format("%g", nodeInterval(i)->weight)
+			<< ", \"degree\": " << interferenceGraph.degree(i) << "}";
+		First = false;
+	}
+	File << "], \"edges\": [";
+	First = true;
+	for (unsigned i = 0; i != numIndices; ++i) {
+		if (!interferenceGraph.hasNode(i))
+			continue;
+		for (unsigned n : interferenceGraph.neighbors(i)) {
+			if (i < n) {
+				File << (First ? "" : ", ") << "[" << i << ", " << n << "]";
+				First = false;
+			}
+		}
+	}
+	File << "]}\n";
 }
 
 FunctionPass* createUSCCRegisterAllocator() {
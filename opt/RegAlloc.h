@@ -0,0 +1,81 @@
+//
+//  RegAlloc.h
+//  uscc
+//
+//  Declares the options that control the USCC
+//  register allocator
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Cap on the number of colors of each register class when simplifying
+// the interference graph, and on the registers linear scan gives a
+// spillable interval (0 means each class uses all of its registers)
+extern size_t NUM_COLORS;
+
+namespace uscc
+{
+namespace opt
+{
+
+// These are set by the driver before the backend runs
+struct RegAllocOptions
+{
+	// Which allocator runs (--regalloc)
+	enum Allocator
+	{
+		// Graph coloring (RegAlloc.cpp)
+		AllocColoring,
+		// Linear scan, much faster on very large functions (RegAllocLinear.cpp)
+		AllocLinear
+	};
+	Allocator allocator = AllocColoring;
+
+	// Enables the optimizing phases of the allocator (coalescing,
+	// optimistic select with spill rounds). Without it, the allocator
+	// runs the plain simplify/select that the regAlloc tests expect.
+	bool optimize = false;
+
+	// How a vreg that found no register is split before it is spilled
+	enum SplitMode
+	{
+		SplitNone,
+		// Split at loop boundaries so it is spilled around loops
+		SplitLoop,
+		// Split into a local interval per block with uses
+		SplitRegion
+	};
+	SplitMode splitMode = SplitNone;
+
+	// Print the simplify/select trace to stdout (the regAlloc tests
+	// compare against it)
+	bool trace = false;
+
+	// Print one line of JSON statistics per function to stdout
+	bool stats = false;
+
+	// Write each function's interference graph to
+	// <graphDumpPrefix>.<function>.dot or .json
+	enum GraphDump
+	{
+		DumpNone,
+		DumpDot,
+		DumpJson
+	};
+	GraphDump graphDump = DumpNone;
+	std::string graphDumpPrefix;
+};
+
+extern RegAllocOptions gRegAllocOptions;
+
+} // opt
+} // uscc
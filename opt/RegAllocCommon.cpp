@@ -0,0 +1,151 @@
+//
+//  RegAllocCommon.cpp
+//  uscc
+//
+//  Implements the spilling, splitting and timing helpers
+//  shared by the USCC register allocators
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "RegAllocCommon.h"
+#include "RegAlloc.h"
+#include "../lib/CodeGen/LiveDebugVariables.h"
+#include "../lib/CodeGen/Spiller.h"
+#include "../lib/CodeGen/SplitKit.h"
+#include "llvm/CodeGen/LiveIntervalAnalysis.h"
+#include "llvm/CodeGen/LiveRangeEdit.h"
+#include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/VirtRegMap.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetInstrInfo.h"
+#include "llvm/Target/TargetMachine.h"
+
+using namespace llvm;
+using uscc::opt::gRegAllocOptions;
+
+namespace uscc
+{
+namespace opt
+{
+
+SpillCodeCount countSpillCode(MachineFunction &MF) {
+	SpillCodeCount Count;
+	const TargetInstrInfo *TII = MF.getTarget().getInstrInfo();
+	const MachineFrameInfo *MFI = MF.getFrameInfo();
+	for (MachineFunction::iterator MBB = MF.begin(), E = MF.end();
+		 MBB != E; ++MBB) {
+		for (MachineBasicBlock::iterator MI = MBB->begin(), ME = MBB->end();
+			 MI != ME; ++MI) {
+			int FI;
+			if (TII->isLoadFromStackSlot(MI, FI) && MFI->isSpillSlotObjectIndex(FI))
+				++Count.reloads;
+			else if (TII->isStoreToStackSlot(MI, FI) && MFI->isSpillSlotObjectIndex(FI))
+				++Count.spillStores;
+		}
+	}
+	return Count;
+}
+
+bool spillVirtReg(Spiller &S, LiveInterval &VirtReg,
+				  SmallVectorImpl<unsigned> &NewVRegs,
+				  MachineFunction &MF, LiveIntervals &LIS, VirtRegMap &VRM) {
+	// The spiller only creates a stack slot when some use could not be
+	// rematerialized
+	unsigned Original = VRM.getOriginal(VirtReg.reg);
+	bool HadSlot = VRM.getStackSlot(Original) != VirtRegMap::NO_STACK_SLOT;
+
+	LiveRangeEdit LRE(&VirtReg, NewVRegs, MF, LIS, &VRM);
+	S.spill(LRE);
+
+	return !HadSlot &&
+		VRM.getStackSlot(Original) == VirtRegMap::NO_STACK_SLOT;
+}
+
+LiveRangeSplitter::LiveRangeSplitter(): MF(nullptr), LIS(nullptr),
+	VRM(nullptr), DebugVars(nullptr) {
+}
+
+// Out of line, where SplitAnalysis and SplitEditor are complete
+LiveRangeSplitter::~LiveRangeSplitter() {
+}
+
+void LiveRangeSplitter::init(MachineFunction &mf, LiveIntervals &lis,
+							 VirtRegMap &vrm, MachineLoopInfo &Loops,
+							 MachineDominatorTree &MDT,
+							 MachineBlockFrequencyInfo &MBFI,
+							 LiveDebugVariables &debugVars) {
+	MF = &mf;
+	LIS = &lis;
+	VRM = &vrm;
+	DebugVars = &debugVars;
+	SA.reset(new SplitAnalysis(*VRM, *LIS, Loops));
+	SE.reset(new SplitEditor(*SA, *LIS, *VRM, MDT, MBFI));
+	splitProducts.clear();
+}
+
+void LiveRangeSplitter::clear() {
+	SE.reset();
+	SA.reset();
+	splitProducts.clear();
+}
+
+bool LiveRangeSplitter::split(LiveInterval &VirtReg,
+							  SmallVectorImpl<unsigned> &NewVRegs,
+							  const std::function<bool()> &CanSplit,
+							  const std::function<void()> &Edit) {
+	if (isSplitProduct(VirtReg.reg))
+		return false;
+
+	unsigned Reg = VirtReg.reg;
+	SA->analyze(&VirtReg);
+	if (!CanSplit()) {
+		SA->clear();
+		return false;
+	}
+
+	if (gRegAllocOptions.trace)
+		outs() << "Splitting " << VirtReg << '\n';
+	LiveRangeEdit LREdit(&VirtReg, NewVRegs, *MF, *LIS, VRM);
+	SE->reset(LREdit, SplitEditor::SM_Size);
+	Edit();
+	SE->finish();
+	SA->clear();
+
+	// Tell LiveDebugVariables about the new ranges
+	DebugVars->splitRegister(Reg, LREdit.regs(), *LIS);
+	for (unsigned NewReg : LREdit.regs()) {
+		splitProducts.insert(NewReg);
+	}
+	return true;
+}
+
+bool LiveRangeSplitter::splitBlocks(LiveInterval &VirtReg,
+									SmallVectorImpl<unsigned> &NewVRegs) {
+	return split(VirtReg, NewVRegs,
+		[this]() {
+			for (const SplitAnalysis::BlockInfo &BI : SA->getUseBlocks()) {
+				if (SA->shouldSplitSingleBlock(BI, false))
+					return true;
+			}
+			return false;
+		},
+		[this]() {
+			for (const SplitAnalysis::BlockInfo &BI : SA->getUseBlocks()) {
+				if (SA->shouldSplitSingleBlock(BI, false))
+					SE->splitSingleBlock(BI);
+			}
+		});
+}
+
+} // opt
+} // uscc
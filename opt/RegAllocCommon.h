@@ -0,0 +1,115 @@
+//
+//  RegAllocCommon.h
+//  uscc
+//
+//  Declares the spilling, splitting and timing helpers
+//  shared by the USCC register allocators
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#pragma once
+#include "llvm/ADT/SmallVector.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_set>
+
+namespace llvm {
+	class LiveDebugVariables;
+	class LiveInterval;
+	class LiveIntervals;
+	class MachineBlockFrequencyInfo;
+	class MachineDominatorTree;
+	class MachineFunction;
+	class MachineLoopInfo;
+	class Spiller;
+	class SplitAnalysis;
+	class SplitEditor;
+	class VirtRegMap;
+}
+
+namespace uscc
+{
+namespace opt
+{
+
+// Adds the time spent in a scope to a phase total
+class PhaseTimer {
+	typedef std::chrono::steady_clock Clock;
+	double &total;
+	Clock::time_point start;
+public:
+	explicit PhaseTimer(double &t) : total(t), start(Clock::now()) {}
+	~PhaseTimer() {
+		total += std::chrono::duration<double>(Clock::now() - start).count();
+	}
+};
+
+// Spill slot loads and stores in a function, for --regalloc-stats
+struct SpillCodeCount {
+	unsigned reloads = 0;
+	unsigned spillStores = 0;
+};
+SpillCodeCount countSpillCode(llvm::MachineFunction &MF);
+
+// Spill VirtReg through the given (inline) spiller, which recomputes
+// rematerializable defs at their uses instead of reloading them. Returns
+// true if every use was rematerialized, so no stack slot was needed.
+bool spillVirtReg(llvm::Spiller &S, llvm::LiveInterval &VirtReg,
+				  llvm::SmallVectorImpl<unsigned> &NewVRegs,
+				  llvm::MachineFunction &MF, llvm::LiveIntervals &LIS,
+				  llvm::VirtRegMap &VRM);
+
+// SplitKit state for splitting live ranges before they are spilled.
+// The vregs a split creates are spilled rather than split again.
+class LiveRangeSplitter {
+public:
+	LiveRangeSplitter();
+	~LiveRangeSplitter();
+
+	void init(llvm::MachineFunction &MF, llvm::LiveIntervals &LIS,
+			  llvm::VirtRegMap &VRM, llvm::MachineLoopInfo &Loops,
+			  llvm::MachineDominatorTree &MDT,
+			  llvm::MachineBlockFrequencyInfo &MBFI,
+			  llvm::LiveDebugVariables &DebugVars);
+	void clear();
+
+	bool isSplitProduct(unsigned Reg) const {
+		return splitProducts.count(Reg) != 0;
+	}
+
+	// Split VirtReg. CanSplit is asked once the analysis has looked at
+	// VirtReg, before any new interval exists; Edit then opens the new
+	// intervals through the editor.
+	bool split(llvm::LiveInterval &VirtReg,
+			   llvm::SmallVectorImpl<unsigned> &NewVRegs,
+			   const std::function<bool()> &CanSplit,
+			   const std::function<void()> &Edit);
+
+	// Give each block with uses a local interval (as in
+	// RAGreedy::tryBlockSplit), so only the live-through parts are spilled
+	bool splitBlocks(llvm::LiveInterval &VirtReg,
+					 llvm::SmallVectorImpl<unsigned> &NewVRegs);
+
+	llvm::SplitAnalysis &analysis() { return *SA; }
+	const llvm::SplitAnalysis &analysis() const { return *SA; }
+	llvm::SplitEditor &editor() { return *SE; }
+
+private:
+	llvm::MachineFunction *MF;
+	llvm::LiveIntervals *LIS;
+	llvm::VirtRegMap *VRM;
+	llvm::LiveDebugVariables *DebugVars;
+	std::unique_ptr<llvm::SplitAnalysis> SA;
+	std::unique_ptr<llvm::SplitEditor> SE;
+	std::unordered_set<unsigned> splitProducts;
+};
+
+} // opt
+} // uscc
@@ -0,0 +1,393 @@
+//
+//  RegAllocLinear.cpp
+//  uscc
+//
+//  Implements a linear scan register allocator with
+//  second-chance binpacking, for functions that are too
+//  large to color quickly.
+//---------------------------------------------------------
+//  Portions of the code in this file are:
+//  Copyright (c) 2003-2014 University of Illinois at
+//  Urbana-Champaign.
+//  All rights reserved.
+//
+//  Distributed under the University of Illinois Open Source
+//  License.
+//---------------------------------------------------------
+//  Remaining code is:
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+
+#include "RegAlloc.h"
+#include "RegAllocCommon.h"
+#include "llvm/CodeGen/Passes.h"
+#include "../lib/CodeGen/AllocationOrder.h"
+#include "../lib/CodeGen/LiveDebugVariables.h"
+#include "../lib/CodeGen/RegAllocBase.h"
+#include "../lib/CodeGen/Spiller.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/CodeGen/CalcSpillWeights.h"
+#include "llvm/CodeGen/LiveIntervalAnalysis.h"
+#include "llvm/CodeGen/LiveRangeEdit.h"
+#include "llvm/CodeGen/LiveRegMatrix.h"
+#include "llvm/CodeGen/LiveStackAnalysis.h"
+#include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstr.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/RegAllocRegistry.h"
+#include "llvm/CodeGen/VirtRegMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/PassAnalysisSupport.h"
+#undef DEBUG
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetInstrInfo.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetRegisterInfo.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+using uscc::opt::gRegAllocOptions;
+using uscc::opt::LiveRangeSplitter;
+using uscc::opt::PhaseTimer;
+using uscc::opt::SpillCodeCount;
+
+#define DEBUG_TYPE "regalloc"
+
+// Allocation trace for --regalloc-trace
+#define TRACE(X) do { if (gRegAllocOptions.trace) { X; } } while (false)
+
+static FunctionPass* createLinearScanRegisterAllocator();
+
+static RegisterRegAlloc linearRegAlloc("uscc-linear",
+									   "USCC linear scan register allocator",
+									   createLinearScanRegisterAllocator);
+
+namespace {
+	// Per-function numbers reported by --regalloc-stats
+	struct LinearStats {
+		unsigned vregs = 0;
+		unsigned evictions = 0;
+		unsigned splits = 0;
+		unsigned spills = 0;
+		unsigned remats = 0;
+		unsigned reloads = 0;
+		unsigned spillStores = 0;
+		// Seconds spent assigning, and splitting or spilling
+		double allocTime = 0;
+		double spillTime = 0;
+	};
+
+	// (start of the interval, vreg), so the earliest interval is on top
+	// and equal starts are taken in register order
+	typedef std::pair<SlotIndex, unsigned> ScanEntry;
+
+	/// Linear scan over the live intervals in order of their start.
+	///
+	/// Intervals are binpacked: LiveRegMatrix tests interference per
+	/// segment, so an interval can be placed in the lifetime holes of
+	/// the intervals already assigned to a register. An interval that
+	/// finds no free register evicts the assigned intervals of lower
+	/// spill weight, which are rescanned for another register (their
+	/// second chance). An interval that loses is split into one piece
+	/// per block with uses, so each piece gets a second chance, and is
+	/// only spilled once it cannot be split further.
+	class RALinearScan : public MachineFunctionPass, public RegAllocBase {
+		MachineFunction *MF;
+		std::unique_ptr<Spiller> SpillerInstance;
+		LiveRangeSplitter Splitter;
+
+		std::priority_queue<ScanEntry, std::vector<ScanEntry>,
+			std::greater<ScanEntry>> Queue;
+
+		LinearStats Stats;
+
+	public:
+		RALinearScan();
+
+		const char* getPassName() const override {
+			return "USCC Linear Scan Register Allocator";
+		}
+
+		void getAnalysisUsage(AnalysisUsage &AU) const override;
+
+		void releaseMemory() override;
+
+		Spiller &spiller() override { return *SpillerInstance; }
+
+		void enqueue(LiveInterval *LI) override {
+			Queue.push(ScanEntry(LI->beginIndex(), LI->reg));
+		}
+
+		LiveInterval *dequeue() override {
+			if (Queue.empty())
+				return nullptr;
+			unsigned Reg = Queue.top().second;
+			Queue.pop();
+			return &LIS->getInterval(Reg);
+		}
+
+		unsigned selectOrSplit(LiveInterval &VirtReg,
+							   SmallVectorImpl<unsigned> &NewVRegs) override;
+
+		bool runOnMachineFunction(MachineFunction &mf) override;
+
+		static char ID;
+
+	private:
+		// Cost of evicting everything assigned to PhysReg that interferes
+		// with VirtReg, or false if something there outweighs VirtReg
+		bool evictionCost(LiveInterval &VirtReg, unsigned PhysReg,
+						  float &Cost);
+		void evictInterferences(LiveInterval &VirtReg, unsigned PhysReg);
+		bool trySplit(LiveInterval &VirtReg, SmallVectorImpl<unsigned> &NewVRegs);
+		void spillVirtReg(LiveInterval &VirtReg,
+						  SmallVectorImpl<unsigned> &NewVRegs);
+		void printStats() const;
+	};
+
+	char RALinearScan::ID = 0;
+} // end anonymous namespace
+
+RALinearScan::RALinearScan(): MachineFunctionPass(ID), MF(nullptr) {
+	initializeLiveDebugVariablesPass(*PassRegistry::getPassRegistry());
+	initializeLiveIntervalsPass(*PassRegistry::getPassRegistry());
+	initializeSlotIndexesPass(*PassRegistry::getPassRegistry());
+	initializeRegisterCoalescerPass(*PassRegistry::getPassRegistry());
+	initializeMachineSchedulerPass(*PassRegistry::getPassRegistry());
+	initializeLiveStacksPass(*PassRegistry::getPassRegistry());
+	initializeMachineDominatorTreePass(*PassRegistry::getPassRegistry());
+	initializeMachineLoopInfoPass(*PassRegistry::getPassRegistry());
+	initializeVirtRegMapPass(*PassRegistry::getPassRegistry());
+	initializeLiveRegMatrixPass(*PassRegistry::getPassRegistry());
+}
+
+void RALinearScan::getAnalysisUsage(AnalysisUsage &AU) const {
+	AU.setPreservesCFG();
+	AU.addRequired<AliasAnalysis>();
+	AU.addPreserved<AliasAnalysis>();
+	AU.addRequired<LiveIntervals>();
+	AU.addPreserved<LiveIntervals>();
+	AU.addPreserved<SlotIndexes>();
+	AU.addRequired<LiveDebugVariables>();
+	AU.addPreserved<LiveDebugVariables>();
+	AU.addRequired<LiveStacks>();
+	AU.addPreserved<LiveStacks>();
+	AU.addRequired<MachineBlockFrequencyInfo>();
+	AU.addPreserved<MachineBlockFrequencyInfo>();
+	AU.addRequiredID(MachineDominatorsID);
+	AU.addPreservedID(MachineDominatorsID);
+	AU.addRequired<MachineLoopInfo>();
+	AU.addPreserved<MachineLoopInfo>();
+	AU.addRequired<VirtRegMap>();
+	AU.addPreserved<VirtRegMap>();
+	AU.addRequired<LiveRegMatrix>();
+	AU.addPreserved<LiveRegMatrix>();
+	MachineFunctionPass::getAnalysisUsage(AU);
+}
+
+void RALinearScan::releaseMemory() {
+	SpillerInstance.reset();
+	Splitter.clear();
+	while (!Queue.empty()) {
+		Queue.pop();
+	}
+	Stats = LinearStats();
+}
+
+unsigned RALinearScan::selectOrSplit(LiveInterval &VirtReg,
+									 SmallVectorImpl<unsigned> &NewVRegs) {
+	// As in the coloring allocator, --num-colors caps a spillable interval
+	// to the first NUM_COLORS registers of its class, so the two can be
+	// compared with the same registers
+	ArrayRef<MCPhysReg> Colors =
+		RegClassInfo.getOrder(MRI->getRegClass(VirtReg.reg));
+	if (NUM_COLORS && VirtReg.isSpillable() && Colors.size() > NUM_COLORS)
+		Colors = Colors.slice(0, NUM_COLORS);
+
+	// Take the first free register, hints first
+	unsigned EvictReg = 0;
+	float EvictCost = 0;
+	AllocationOrder Order(VirtReg.reg, *VRM, RegClassInfo);
+	while (unsigned PhysReg = Order.next()) {
+		if (std::find(Colors.begin(), Colors.end(), PhysReg) == Colors.end())
+			continue;
+		switch (Matrix->checkInterference(VirtReg, PhysReg)) {
+			case LiveRegMatrix::IK_Free:
+				TRACE(outs() << "Assigning to physical register: " << VirtReg << '\n');
+				return PhysReg;
+
+			case LiveRegMatrix::IK_VirtReg: {
+				// Remember the register that is cheapest to free
+				float Cost;
+				if (evictionCost(VirtReg, PhysReg, Cost) &&
+					(!EvictReg || Cost < EvictCost)) {
+					EvictReg = PhysReg;
+					EvictCost = Cost;
+				}
+				continue;
+			}
+
+			default:
+				// RegMask or RegUnit interference.
+				continue;
+		}
+	}
+
+	if (EvictReg) {
+		evictInterferences(VirtReg, EvictReg);
+		TRACE(outs() << "Assigning to physical register: " << VirtReg << '\n');
+		return EvictReg;
+	}
+
+	if (!VirtReg.isSpillable())
+		return ~0u;
+
+	if (trySplit(VirtReg, NewVRegs))
+		return 0;
+
+	TRACE(outs() << "Spilling " << VirtReg << '\n');
+	spillVirtReg(VirtReg, NewVRegs);
+	return 0;
+}
+
+bool RALinearScan::evictionCost(LiveInterval &VirtReg, unsigned PhysReg,
+								float &Cost) {
+	Cost = 0;
+	for (MCRegUnitIterator Units(PhysReg, TRI); Units.isValid(); ++Units) {
+		LiveIntervalUnion::Query &Q = Matrix->query(VirtReg, *Units);
+		Q.collectInterferingVRegs();
+		if (Q.seenUnspillableVReg())
+			return false;
+		for (LiveInterval *Intf : Q.interferingVRegs()) {
+			// Only lighter intervals are evicted, so evictions cannot cycle
+			if (!Intf->isSpillable() || Intf->weight >= VirtReg.weight)
+				return false;
+			Cost += Intf->weight;
+		}
+	}
+	return true;
+}
+
+void RALinearScan::evictInterferences(LiveInterval &VirtReg, unsigned PhysReg) {
+	// Collect first, the queries are invalid once anything is unassigned.
+	// The same interval may show up on several units.
+	SmallVector<LiveInterval *, 8> Intfs;
+	SmallPtrSet<LiveInterval *, 8> Seen;
+	for (MCRegUnitIterator Units(PhysReg, TRI); Units.isValid(); ++Units) {
+		LiveIntervalUnion::Query &Q = Matrix->query(VirtReg, *Units);
+		Q.collectInterferingVRegs();
+		for (LiveInterval *Intf : Q.interferingVRegs()) {
+			if (Seen.insert(Intf))
+				Intfs.push_back(Intf);
+		}
+	}
+
+	// Evicted intervals are scanned again for a register
+	for (LiveInterval *Intf : Intfs) {
+		TRACE(outs() << "Evicting " << *Intf << '\n');
+		Matrix->unassign(*Intf);
+		enqueue(Intf);
+		++Stats.evictions;
+	}
+}
+
+// Split VirtReg into a local interval per block with uses. The pieces are
+// short enough to fit in the holes other intervals leave.
+bool RALinearScan::trySplit(LiveInterval &VirtReg,
+							SmallVectorImpl<unsigned> &NewVRegs) {
+	PhaseTimer T(Stats.spillTime);
+	if (!Splitter.splitBlocks(VirtReg, NewVRegs))
+		return false;
+	++Stats.splits;
+	return true;
+}
+
+void RALinearScan::spillVirtReg(LiveInterval &VirtReg,
+								SmallVectorImpl<unsigned> &NewVRegs) {
+	PhaseTimer T(Stats.spillTime);
+	if (uscc::opt::spillVirtReg(spiller(), VirtReg, NewVRegs, *MF, *LIS, *VRM))
+		++Stats.remats;
+	else
+		++Stats.spills;
+}
+
+bool RALinearScan::runOnMachineFunction(MachineFunction &mf) {
+	DEBUG(dbgs() << "********** USCC LINEAR SCAN **********\n"
+		  << "********** Function: " << mf.getName() << '\n');
+	TRACE(outs() << "********** USCC LINEAR SCAN **********\n"
+		  << "********** Function: " << mf.getName() << '\n');
+	MF = &mf;
+	RegAllocBase::init(getAnalysis<VirtRegMap>(),
+					   getAnalysis<LiveIntervals>(),
+					   getAnalysis<LiveRegMatrix>());
+
+	calculateSpillWeightsAndHints(*LIS, *MF,
+								  getAnalysis<MachineLoopInfo>(),
+								  getAnalysis<MachineBlockFrequencyInfo>());
+
+	SpillerInstance.reset(createInlineSpiller(*this, *MF, *VRM));
+	Splitter.init(*MF, *LIS, *VRM, getAnalysis<MachineLoopInfo>(),
+				  getAnalysis<MachineDominatorTree>(),
+				  getAnalysis<MachineBlockFrequencyInfo>(),
+				  getAnalysis<LiveDebugVariables>());
+
+	for (unsigned i = 0, e = MRI->getNumVirtRegs(); i != e; ++i) {
+		if (!MRI->reg_nodbg_empty(TargetRegisterInfo::index2VirtReg(i)))
+			++Stats.vregs;
+	}
+
+	double spillTime = Stats.spillTime;
+	{
+		PhaseTimer T(Stats.allocTime);
+		allocatePhysRegs();
+	}
+	Stats.allocTime -= Stats.spillTime - spillTime;
+
+	if (gRegAllocOptions.stats) {
+		SpillCodeCount Count = uscc::opt::countSpillCode(*MF);
+		Stats.reloads = Count.reloads;
+		Stats.spillStores = Count.spillStores;
+		printStats();
+	}
+
+	DEBUG(dbgs() << "Post alloc VirtRegMap:\n" << *VRM << "\n");
+
+	releaseMemory();
+	return true;
+}
+
+// Print one JSON object (on one line) for this function
+void RALinearScan::printStats() const {
+	outs() << "{\"function\": \"" << MF->getName() << "\""
+		<< ", \"allocator\": \"linear\""
+		<< ", \"vregs\": " << Stats.vregs
+		<< ", \"evictions\": " << Stats.evictions
+		<< ", \"spills\": " << Stats.spills
+		<< ", \"rematerialized\": " << Stats.remats
+		<< ", \"splits\": " << Stats.splits
+		<< ", \"reloads\": " << Stats.reloads
+		<< ", \"spill_stores\": " << Stats.spillStores
+		<< ", \"time\": {"
+		<< "\"allocate\": " << format("%.6f", Stats.allocTime)
+		<< ", \"spill\": " << format("%.6f", Stats.spillTime)
+		<< "}}\n";
+}
+
+FunctionPass* createLinearScanRegisterAllocator() {
+	return new RALinearScan();
+}
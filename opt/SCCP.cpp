@@ -0,0 +1,489 @@
+//
+//  SCCP.cpp
+//  uscc
+//
+//  Implements sparse conditional constant propagation --
+//  SSA values are evaluated on a constant lattice, only
+//  along CFG edges that can execute, and every value that
+//  is always the same constant is replaced by it
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+bool SCCP::runOnFunction(Function& F)
+{
+	bool changed = false;
+
+	mValues.clear();
+	mExecutable.clear();
+	mExecutableEdges.clear();
+	mBlockWorklist.clear();
+	mInstrWorklist.clear();
+
+	// Solve, then give branches that still depend on an unknown value
+	// (something only undef flows into) both successors, and solve again
+	markBlockExecutable(&F.getEntryBlock());
+	do
+	{
+		solve();
+	} while (resolveUnknownBranches(F));
+
+	// Replace every instruction that is always the same constant. Blocks
+	// that never execute are left for SimplifyCFG.
+	for (Function::iterator blockIter = F.begin(); blockIter != F.end(); ++blockIter)
+	{
+		if (mExecutable.find(blockIter) == mExecutable.end())
+		{
+			continue;
+		}
+
+		BasicBlock::iterator instrIter = blockIter->begin();
+		while (instrIter != blockIter->end())
+		{
+			Instruction* I = instrIter;
+			++instrIter;
+
+			LatticeVal val = getValue(I);
+			if (val.mState == LatticeVal::Const)
+			{
+				I->replaceAllUsesWith(val.mConst);
+				I->eraseFromParent();
+				changed = true;
+			}
+		}
+	}
+
+	return changed;
+}
+
+SCCP::LatticeVal SCCP::getValue(Value* V)
+{
+	LatticeVal val;
+	if (Constant* C = dyn_cast<Constant>(V))
+	{
+		// Undef could be any value, so it stays unknown
+		if (!isa<UndefValue>(C))
+		{
+			val.mState = LatticeVal::Const;
+			val.mConst = C;
+		}
+		return val;
+	}
+
+	if (!isa<Instruction>(V))
+	{
+		// Arguments and globals are not known
+		val.mState = LatticeVal::Overdefined;
+		return val;
+	}
+
+	auto iter = mValues.find(V);
+	if (iter != mValues.end())
+	{
+		return iter->second;
+	}
+	return val;
+}
+
+// Lattice values only ever move down (Unknown -> Const -> Overdefined),
+// and each change queues the users to be visited again
+void SCCP::markConstant(Instruction* I, Constant* C)
+{
+	LatticeVal& val = mValues[I];
+	if (val.mState == LatticeVal::Overdefined ||
+		(val.mState == LatticeVal::Const && val.mConst == C))
+	{
+		return;
+	}
+
+	if (val.mState == LatticeVal::Const)
+	{
+		// A second, different constant
+		val.mState = LatticeVal::Overdefined;
+		val.mConst = nullptr;
+	}
+	else
+	{
+		val.mState = LatticeVal::Const;
+		val.mConst = C;
+	}
+	mInstrWorklist.push_back(I);
+}
+
+void SCCP::markOverdefined(Instruction* I)
+{
+	LatticeVal& val = mValues[I];
+	if (val.mState == LatticeVal::Overdefined)
+	{
+		return;
+	}
+	val.mState = LatticeVal::Overdefined;
+	val.mConst = nullptr;
+	mInstrWorklist.push_back(I);
+}
+
+void SCCP::markBlockExecutable(BasicBlock* BB)
+{
+	if (mExecutable.insert(BB).second)
+	{
+		mBlockWorklist.push_back(BB);
+	}
+}
+
+void SCCP::markEdgeExecutable(BasicBlock* from, BasicBlock* to)
+{
+	if (!mExecutableEdges.insert(std::make_pair(from, to)).second)
+	{
+		return;
+	}
+
+	if (mExecutable.find(to) == mExecutable.end())
+	{
+		markBlockExecutable(to);
+	}
+	else
+	{
+		// Only the PHIs can see the new edge
+		for (BasicBlock::iterator instrIter = to->begin(); isa<PHINode>(instrIter); ++instrIter)
+		{
+			visitPHI(cast<PHINode>(instrIter));
+		}
+	}
+}
+
+bool SCCP::isEdgeExecutable(BasicBlock* from, BasicBlock* to) const
+{
+	return mExecutableEdges.find(std::make_pair(from, to)) != mExecutableEdges.end();
+}
+
+void SCCP::solve()
+{
+	while (!mBlockWorklist.empty() || !mInstrWorklist.empty())
+	{
+		// Users of values that changed
+		while (!mInstrWorklist.empty())
+		{
+			Instruction* I = mInstrWorklist.back();
+			mInstrWorklist.pop_back();
+			for (User* U : I->users())
+			{
+				Instruction* userInstr = dyn_cast<Instruction>(U);
+				if (userInstr != nullptr &&
+					mExecutable.find(userInstr->getParent()) != mExecutable.end())
+				{
+					visit(userInstr);
+				}
+			}
+		}
+
+		// Blocks that just became executable
+		while (!mBlockWorklist.empty())
+		{
+			BasicBlock* BB = mBlockWorklist.back();
+			mBlockWorklist.pop_back();
+			for (BasicBlock::iterator instrIter = BB->begin(); instrIter != BB->end(); ++instrIter)
+			{
+				visit(instrIter);
+			}
+		}
+	}
+}
+
+bool SCCP::resolveUnknownBranches(Function&)
+{
+	bool changed = false;
+	// Marking edges can add executable blocks, so walk a copy
+	std::vector<BasicBlock*> blocks(mExecutable.begin(), mExecutable.end());
+	for (BasicBlock* BB : blocks)
+	{
+		TerminatorInst* term = BB->getTerminator();
+		if (term->getNumSuccessors() < 2)
+		{
+			continue;
+		}
+
+		Value* cond = nullptr;
+		if (BranchInst* branch = dyn_cast<BranchInst>(term))
+		{
+			cond = branch->getCondition();
+		}
+		else if (SwitchInst* sw = dyn_cast<SwitchInst>(term))
+		{
+			cond = sw->getCondition();
+		}
+
+		if (cond != nullptr && getValue(cond).mState == LatticeVal::Unknown)
+		{
+			for (unsigned i = 0; i < term->getNumSuccessors(); ++i)
+			{
+				if (!isEdgeExecutable(BB, term->getSuccessor(i)))
+				{
+					changed = true;
+				}
+			}
+			if (Instruction* condInstr = dyn_cast<Instruction>(cond))
+			{
+				markOverdefined(condInstr);
+			}
+			for (unsigned i = 0; i < term->getNumSuccessors(); ++i)
+			{
+				markEdgeExecutable(BB, term->getSuccessor(i));
+			}
+		}
+	}
+	return changed;
+}
+
+void SCCP::visit(Instruction* I)
+{
+	if (PHINode* phi = dyn_cast<PHINode>(I))
+	{
+		visitPHI(phi);
+		return;
+	}
+	if (TerminatorInst* term = dyn_cast<TerminatorInst>(I))
+	{
+		visitTerminator(term);
+		return;
+	}
+	if (I->getType()->isVoidTy())
+	{
+		return;
+	}
+
+	// Only pure integer computations are folded
+	if (!isa<BinaryOperator>(I) && !isa<CastInst>(I) &&
+		!isa<ICmpInst>(I) && !isa<SelectInst>(I))
+	{
+		markOverdefined(I);
+		return;
+	}
+
+	if (SelectInst* select = dyn_cast<SelectInst>(I))
+	{
+		LatticeVal cond = getValue(select->getCondition());
+		if (cond.mState == LatticeVal::Unknown)
+		{
+			return;
+		}
+		if (cond.mState == LatticeVal::Overdefined)
+		{
+			// Still constant if both sides are the same constant
+			LatticeVal t = getValue(select->getTrueValue());
+			LatticeVal f = getValue(select->getFalseValue());
+			if (t.mState == LatticeVal::Overdefined || f.mState == LatticeVal::Overdefined)
+			{
+				markOverdefined(I);
+			}
+			else if (t.mState == LatticeVal::Const && f.mState == LatticeVal::Const)
+			{
+				if (t.mConst == f.mConst)
+				{
+					markConstant(I, t.mConst);
+				}
+				else
+				{
+					markOverdefined(I);
+				}
+			}
+			return;
+		}
+		Value* chosen = cast<ConstantInt>(cond.mConst)->isOne() ?
+			select->getTrueValue() : select->getFalseValue();
+		LatticeVal val = getValue(chosen);
+		if (val.mState == LatticeVal::Const)
+		{
+			markConstant(I, val.mConst);
+		}
+		else if (val.mState == LatticeVal::Overdefined)
+		{
+			markOverdefined(I);
+		}
+		return;
+	}
+
+	// Any overdefined operand makes the result overdefined, and an unknown
+	// operand means there is nothing to compute yet
+	SmallVector<ConstantInt*, 2> ops;
+	for (Value* op : I->operands())
+	{
+		LatticeVal val = getValue(op);
+		if (val.mState == LatticeVal::Overdefined)
+		{
+			markOverdefined(I);
+			return;
+		}
+		if (val.mState == LatticeVal::Unknown)
+		{
+			return;
+		}
+		ConstantInt* C = dyn_cast<ConstantInt>(val.mConst);
+		if (C == nullptr)
+		{
+			markOverdefined(I);
+			return;
+		}
+		ops.push_back(C);
+	}
+
+	Constant* result = nullptr;
+	if (BinaryOperator* binOp = dyn_cast<BinaryOperator>(I))
+	{
+		// Leave division by zero and INT_MIN / -1 to trap at run time
+		switch (binOp->getOpcode())
+		{
+			case Instruction::SDiv:
+			case Instruction::SRem:
+				if (ops[1]->isMinusOne() && ops[0]->getValue().isMinSignedValue())
+				{
+					markOverdefined(I);
+					return;
+				}
+				// Fall through
+			case Instruction::UDiv:
+			case Instruction::URem:
+				if (ops[1]->isZero())
+				{
+					markOverdefined(I);
+					return;
+				}
+				break;
+			default:
+				break;
+		}
+		result = ConstantExpr::get(binOp->getOpcode(), ops[0], ops[1]);
+	}
+	else if (CastInst* cast = dyn_cast<CastInst>(I))
+	{
+		result = ConstantExpr::getCast(cast->getOpcode(), ops[0], cast->getType());
+	}
+	else
+	{
+		ICmpInst* icmp = llvm::cast<ICmpInst>(I);
+		result = ConstantExpr::getICmp(icmp->getPredicate(), ops[0], ops[1]);
+	}
+
+	// Anything that did not fold down to an integer is left alone
+	if (isa<ConstantInt>(result))
+	{
+		markConstant(I, result);
+	}
+	else
+	{
+		markOverdefined(I);
+	}
+}
+
+// A PHI merges the values flowing in over executable edges only
+void SCCP::visitPHI(PHINode* phi)
+{
+	LatticeVal& current = mValues[phi];
+	if (current.mState == LatticeVal::Overdefined)
+	{
+		return;
+	}
+
+	Constant* merged = nullptr;
+	for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i)
+	{
+		if (!isEdgeExecutable(phi->getIncomingBlock(i), phi->getParent()))
+		{
+			continue;
+		}
+		LatticeVal val = getValue(phi->getIncomingValue(i));
+		if (val.mState == LatticeVal::Unknown)
+		{
+			continue;
+		}
+		if (val.mState == LatticeVal::Overdefined ||
+			(merged != nullptr && merged != val.mConst))
+		{
+			markOverdefined(phi);
+			return;
+		}
+		merged = val.mConst;
+	}
+
+	if (merged != nullptr)
+	{
+		markConstant(phi, merged);
+	}
+}
+
+void SCCP::visitTerminator(TerminatorInst* term)
+{
+	BasicBlock* BB = term->getParent();
+	if (BranchInst* branch = dyn_cast<BranchInst>(term))
+	{
+		if (branch->isUnconditional())
+		{
+			markEdgeExecutable(BB, branch->getSuccessor(0));
+			return;
+		}
+
+		LatticeVal cond = getValue(branch->getCondition());
+		if (cond.mState == LatticeVal::Const)
+		{
+			// Successor 0 is taken on true
+			ConstantInt* C = dyn_cast<ConstantInt>(cond.mConst);
+			if (C != nullptr)
+			{
+				markEdgeExecutable(BB, branch->getSuccessor(C->isZero() ? 1 : 0));
+				return;
+			}
+		}
+		else if (cond.mState == LatticeVal::Unknown)
+		{
+			return;
+		}
+	}
+	else if (SwitchInst* sw = dyn_cast<SwitchInst>(term))
+	{
+		LatticeVal cond = getValue(sw->getCondition());
+		if (cond.mState == LatticeVal::Unknown)
+		{
+			return;
+		}
+		if (ConstantInt* C = dyn_cast_or_null<ConstantInt>(cond.mConst))
+		{
+			markEdgeExecutable(BB, sw->findCaseValue(C).getCaseSuccessor());
+			return;
+		}
+	}
+
+	// Anything else may go to every successor
+	for (unsigned i = 0; i < term->getNumSuccessors(); ++i)
+	{
+		markEdgeExecutable(BB, term->getSuccessor(i));
+	}
+}
+
+void SCCP::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Branches are folded later by SimplifyCFG
+	Info.setPreservesCFG();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::SCCP::ID = 0;
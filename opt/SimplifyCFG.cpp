@@ -0,0 +1,299 @@
+//
+//  SimplifyCFG.cpp
+//  uscc
+//
+//  Implements CFG simplification -- constant folding,
+//  block merging and forwarding of empty blocks
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+#include <algorithm>
+#include <set>
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// Constant operands and PHIs that merge the same value everywhere
+bool SimplifyCFG::foldConstants(Function& F)
+{
+	bool changed = false;
+	for (BasicBlock& block : F)
+	{
+		BasicBlock::iterator instrIter = block.begin();
+		while (instrIter != block.end())
+		{
+			Instruction* I = instrIter;
+			++instrIter;
+			Value* value = ConstantFoldInstruction(I);
+			if (value == nullptr)
+			{
+				if (PHINode* phi = dyn_cast<PHINode>(I))
+				{
+					value = phi->hasConstantValue();
+				}
+			}
+			if (value != nullptr && value != I)
+			{
+				I->replaceAllUsesWith(value);
+				I->eraseFromParent();
+				changed = true;
+			}
+		}
+	}
+	return changed;
+}
+
+// Branches on a constant, or to the same block either way
+bool SimplifyCFG::foldBranches(Function& F)
+{
+	bool changed = false;
+	for (BasicBlock& block : F)
+	{
+		BranchInst* br = dyn_cast<BranchInst>(block.getTerminator());
+		if (br == nullptr || !br->isConditional())
+		{
+			continue;
+		}
+
+		BasicBlock* dest = nullptr;
+		if (br->getSuccessor(0) == br->getSuccessor(1))
+		{
+			dest = br->getSuccessor(0);
+			dest->removePredecessor(&block);
+		}
+		else if (ConstantInt* cond = dyn_cast<ConstantInt>(br->getCondition()))
+		{
+			dest = br->getSuccessor(cond->isZero() ? 1 : 0);
+			br->getSuccessor(cond->isZero() ? 0 : 1)->removePredecessor(&block);
+		}
+		if (dest != nullptr)
+		{
+			Value* cond = br->getCondition();
+			BranchInst::Create(dest, br);
+			br->eraseFromParent();
+			Instruction* condInstr = dyn_cast<Instruction>(cond);
+			if (condInstr != nullptr && condInstr->use_empty())
+			{
+				condInstr->eraseFromParent();
+			}
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Blocks the entry can't reach, found the same way DeadBlocks does
+bool SimplifyCFG::removeUnreachable(Function& F)
+{
+	std::set<BasicBlock*> visited;
+	std::vector<BasicBlock*> unreachable;
+	for (auto iter = df_ext_begin(&F.getEntryBlock(), visited);
+		 iter != df_ext_end(&F.getEntryBlock(), visited); iter++);
+
+	for (BasicBlock& block : F)
+	{
+		if (visited.find(&block) == visited.end())
+		{
+			unreachable.push_back(&block);
+		}
+	}
+	for (BasicBlock* block : unreachable)
+	{
+		for (auto iter = succ_begin(block); iter != succ_end(block); iter++)
+		{
+			iter->removePredecessor(block);
+		}
+		block->dropAllReferences();
+	}
+	for (BasicBlock* block : unreachable)
+	{
+		block->eraseFromParent();
+	}
+	return !unreachable.empty();
+}
+
+// pred: ...; br block   +   block: ...   =>   pred: ...; ...
+bool SimplifyCFG::mergeIntoPredecessor(BasicBlock* block)
+{
+	BasicBlock* pred = block->getSinglePredecessor();
+	if (pred == nullptr || pred == block ||
+		pred->getTerminator()->getNumSuccessors() != 1)
+	{
+		return false;
+	}
+
+	while (PHINode* phi = dyn_cast<PHINode>(block->begin()))
+	{
+		phi->replaceAllUsesWith(phi->getIncomingValue(0));
+		phi->eraseFromParent();
+	}
+	pred->getTerminator()->eraseFromParent();
+	pred->getInstList().splice(pred->end(), block->getInstList());
+	// Successors' PHIs now come from pred
+	block->replaceAllUsesWith(pred);
+	block->eraseFromParent();
+	++mNumMerged;
+	return true;
+}
+
+// A block that is only PHIs and "br succ" can be skipped: each of its
+// predecessors branches to succ instead, and succ's PHIs take the value
+// they had through block
+bool SimplifyCFG::forwardBlock(BasicBlock* block)
+{
+	BranchInst* br = dyn_cast<BranchInst>(block->getTerminator());
+	if (br == nullptr || br->isConditional() ||
+		block == &block->getParent()->getEntryBlock() || block->getFirstNonPHI() != br)
+	{
+		return false;
+	}
+	BasicBlock* succ = br->getSuccessor(0);
+	if (succ == block ||
+		(mKeepPreheaders && (mLoopHeaders.count(succ) != 0 || mLoopHeaders.count(block) != 0)))
+	{
+		return false;
+	}
+
+	// Each predecessor must reach block once and not reach succ already,
+	// so succ's PHIs get exactly one entry per edge
+	std::vector<BasicBlock*> preds;
+	for (auto iter = pred_begin(block); iter != pred_end(block); ++iter)
+	{
+		BasicBlock* pred = *iter;
+		if (std::find(preds.begin(), preds.end(), pred) != preds.end() ||
+			std::find(succ_begin(pred), succ_end(pred), succ) != succ_end(pred))
+		{
+			return false;
+		}
+		preds.push_back(pred);
+	}
+	if (preds.empty())
+	{
+		return false;
+	}
+
+	// block's own PHIs may only feed succ's PHIs on the edge from block
+	for (BasicBlock::iterator iter = block->begin(); isa<PHINode>(iter); ++iter)
+	{
+		for (Use& U : iter->uses())
+		{
+			PHINode* userPhi = dyn_cast<PHINode>(U.getUser());
+			if (userPhi == nullptr || userPhi->getParent() != succ ||
+				userPhi->getIncomingBlock(U) != block)
+			{
+				return false;
+			}
+		}
+	}
+
+	for (BasicBlock::iterator iter = succ->begin(); isa<PHINode>(iter); ++iter)
+	{
+		PHINode* phi = cast<PHINode>(iter);
+		Value* value = phi->getIncomingValueForBlock(block);
+		PHINode* blockPhi = dyn_cast<PHINode>(value);
+		if (blockPhi != nullptr && blockPhi->getParent() != block)
+		{
+			blockPhi = nullptr;
+		}
+		phi->removeIncomingValue(block, false);
+		for (BasicBlock* pred : preds)
+		{
+			phi->addIncoming(blockPhi != nullptr ? blockPhi->getIncomingValueForBlock(pred) : value, pred);
+		}
+	}
+	for (BasicBlock* pred : preds)
+	{
+		pred->getTerminator()->replaceUsesOfWith(block, succ);
+	}
+
+	while (PHINode* phi = dyn_cast<PHINode>(block->begin()))
+	{
+		phi->dropAllReferences();
+		phi->eraseFromParent();
+	}
+	block->eraseFromParent();
+	++mNumForwarded;
+	return true;
+}
+
+bool SimplifyCFG::runOnFunction(Function& F)
+{
+	mNumMerged = 0;
+	mNumForwarded = 0;
+	mLoopHeaders.clear();
+	if (mKeepPreheaders)
+	{
+		// Merging and forwarding never remove a loop header, so the
+		// headers found up front stay valid
+		LoopInfo& loopInfo = getAnalysis<LoopInfo>();
+		for (BasicBlock& block : F)
+		{
+			if (loopInfo.isLoopHeader(&block))
+			{
+				mLoopHeaders.insert(&block);
+			}
+		}
+	}
+
+	bool changed = false;
+	bool iterChanged = true;
+	while (iterChanged)
+	{
+		iterChanged = foldConstants(F);
+		iterChanged |= foldBranches(F);
+		iterChanged |= removeUnreachable(F);
+
+		Function::iterator blockIter = F.begin();
+		while (blockIter != F.end())
+		{
+			BasicBlock* block = blockIter;
+			++blockIter;
+			if (mergeIntoPredecessor(block) || forwardBlock(block))
+			{
+				iterChanged = true;
+			}
+		}
+		changed |= iterChanged;
+	}
+
+	if (gOptOptions.stats)
+	{
+		outs() << "SimplifyCFG: " << F.getName() << ": merged " << mNumMerged
+			<< " blocks, forwarded " << mNumForwarded << " blocks\n";
+	}
+	return changed;
+}
+
+void SimplifyCFG::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	if (mKeepPreheaders)
+	{
+		Info.addRequired<LoopInfo>();
+	}
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::SimplifyCFG::ID = 0;
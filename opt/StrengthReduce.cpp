@@ -0,0 +1,182 @@
+//
+//  StrengthReduce.cpp
+//  uscc
+//
+//  Implements strength reduction of array subscripts --
+//  base[i + C] in a loop becomes a pointer that is
+//  stepped along with the induction variable i
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// The index must be iv, iv + C or iv - C for an induction variable iv
+// of the current loop
+bool StrengthReduce::matchIndex(Value* index, PHINode*& iv, int64_t& offset) const
+{
+	offset = 0;
+	if (BinaryOperator* op = dyn_cast<BinaryOperator>(index))
+	{
+		ConstantInt* amount = dyn_cast<ConstantInt>(op->getOperand(1));
+		Value* other = op->getOperand(0);
+		if (op->getOpcode() == Instruction::Add && amount == nullptr)
+		{
+			amount = dyn_cast<ConstantInt>(op->getOperand(0));
+			other = op->getOperand(1);
+		}
+		if (amount == nullptr || amount->getBitWidth() > 32 ||
+			(op->getOpcode() != Instruction::Add && op->getOpcode() != Instruction::Sub))
+		{
+			return false;
+		}
+		offset = amount->getSExtValue();
+		if (op->getOpcode() == Instruction::Sub)
+		{
+			offset = -offset;
+		}
+		index = other;
+	}
+
+	iv = dyn_cast<PHINode>(index);
+	return iv != nullptr && mSteps.find(iv) != mSteps.end();
+}
+
+// Replaces the addresses with a pointer PHI that starts at
+// base + start + C and moves by step elements each iteration
+void StrengthReduce::reduce(const AddressKey& key, const std::vector<GetElementPtrInst*>& geps)
+{
+	Value* base = std::get<0>(key);
+	PHINode* iv = std::get<1>(key);
+	int64_t offset = std::get<2>(key);
+	BasicBlock* header = mCurrLoop->getHeader();
+	BasicBlock* preheader = mCurrLoop->getLoopPreheader();
+	BasicBlock* latch = mCurrLoop->getLoopLatch();
+
+	// The pointer may run one step past the array after the last
+	// iteration, so these GEPs are not inbounds
+	IRBuilder<> pre(preheader->getTerminator());
+	Value* start = iv->getIncomingValueForBlock(preheader);
+	Value* index = start;
+	if (offset != 0)
+	{
+		index = pre.CreateAdd(start, ConstantInt::get(start->getType(), offset), "lsr.start");
+	}
+	Value* init = pre.CreateGEP(base, index, base->getName() + ".lsr");
+
+	PHINode* ptr = PHINode::Create(init->getType(), 2, base->getName() + ".iv", header->begin());
+	ptr->addIncoming(init, preheader);
+	IRBuilder<> step(latch->getTerminator());
+	Value* next = step.CreateGEP(ptr, ConstantInt::get(start->getType(), mSteps[iv]),
+		base->getName() + ".iv.next");
+	ptr->addIncoming(next, latch);
+
+	for (GetElementPtrInst* gep : geps)
+	{
+		gep->replaceAllUsesWith(ptr);
+		gep->eraseFromParent();
+	}
+	++mNumReduced;
+}
+
+bool StrengthReduce::runOnLoop(Loop* L, LPPassManager& LPM)
+{
+	mCurrLoop = L;
+	mNumReduced = 0;
+	mSteps.clear();
+
+	BasicBlock* header = L->getHeader();
+	BasicBlock* latch = L->getLoopLatch();
+	if (L->getLoopPreheader() == nullptr || latch == nullptr)
+	{
+		return false;
+	}
+
+	for (BasicBlock::iterator iter = header->begin(); isa<PHINode>(iter); ++iter)
+	{
+		PHINode* phi = cast<PHINode>(iter);
+		int64_t step;
+		if (phi->getType()->isIntegerTy() && getInductionStep(phi, latch, step))
+		{
+			mSteps[phi] = step;
+		}
+	}
+	if (mSteps.empty())
+	{
+		return false;
+	}
+
+	// Group the single index GEPs off invariant bases, so equal
+	// addresses share one pointer
+	std::map<AddressKey, std::vector<GetElementPtrInst*>> groups;
+	std::vector<AddressKey> order;
+	for (BasicBlock* block : L->getBlocks())
+	{
+		for (Instruction& I : *block)
+		{
+			GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(&I);
+			if (gep == nullptr || gep->getNumIndices() != 1 ||
+				!L->isLoopInvariant(gep->getPointerOperand()))
+			{
+				continue;
+			}
+
+			PHINode* iv;
+			int64_t offset;
+			if (matchIndex(gep->getOperand(1), iv, offset))
+			{
+				AddressKey key(gep->getPointerOperand(), iv, offset);
+				if (groups[key].empty())
+				{
+					order.push_back(key);
+				}
+				groups[key].push_back(gep);
+			}
+		}
+	}
+
+	for (const AddressKey& key : order)
+	{
+		reduce(key, groups[key]);
+	}
+
+	if (gOptOptions.stats)
+	{
+		outs() << "StrengthReduce: " << header->getParent()->getName()
+			<< ": loop " << header->getName() << ": " << mNumReduced
+			<< " pointer induction variables\n";
+	}
+	return mNumReduced > 0;
+}
+
+void StrengthReduce::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Only adds PHIs and address arithmetic
+	Info.setPreservesCFG();
+	Info.addRequired<LoopInfo>();
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::StrengthReduce::ID = 0;
@@ -0,0 +1,246 @@
+//
+//  TailRecursion.cpp
+//  uscc
+//
+//  Implements tail recursion elimination -- self calls
+//  in tail position become a loop, with an accumulator
+//  for add/mul of the call's result
+//
+//---------------------------------------------------------
+//  Copyright (c) 2014, Sanjay Madhav
+//  All rights reserved.
+//
+//  This file is distributed under the BSD license.
+//  See LICENSE.TXT for details.
+//---------------------------------------------------------
+#include "Passes.h"
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Support/raw_ostream.h>
+#pragma clang diagnostic pop
+
+using namespace llvm;
+
+namespace uscc
+{
+namespace opt
+{
+
+// Matches a self call that is followed by one of
+//     ret call
+//     br to a block that just returns (call, via a PHI, or void)
+//     op = add/mul call, x; ret op
+bool TailRecursion::matchTailCall(CallInst* call, TailCall& site)
+{
+	site.mCall = call;
+	site.mAccumulate = nullptr;
+	site.mOperand = nullptr;
+	site.mReturnBlock = nullptr;
+
+	// The next iteration reuses this frame's allocas, so the call must
+	// not be handed one of them
+	for (unsigned i = 0; i < call->getNumArgOperands(); i++)
+	{
+		Value* arg = call->getArgOperand(i);
+		if (arg->getType()->isPointerTy())
+		{
+			Value* obj = GetUnderlyingObject(arg);
+			if (!isa<Argument>(obj) && !isa<GlobalVariable>(obj))
+			{
+				return false;
+			}
+		}
+	}
+
+	Instruction* next = call->getNextNode();
+	if (BinaryOperator* op = dyn_cast<BinaryOperator>(next))
+	{
+		if ((op->getOpcode() != Instruction::Add && op->getOpcode() != Instruction::Mul) ||
+			!call->hasOneUse())
+		{
+			return false;
+		}
+		site.mAccumulate = op;
+		site.mOperand = op->getOperand(0) == call ? op->getOperand(1) : op->getOperand(0);
+		if (site.mOperand == call)
+		{
+			return false;
+		}
+		next = op->getNextNode();
+	}
+
+	Value* result = site.mAccumulate != nullptr ? static_cast<Value*>(site.mAccumulate) : call;
+	if (ReturnInst* ret = dyn_cast<ReturnInst>(next))
+	{
+		return ret->getReturnValue() == nullptr ? call->use_empty() :
+			(ret->getReturnValue() == result && result->hasOneUse());
+	}
+
+	BranchInst* br = dyn_cast<BranchInst>(next);
+	if (site.mAccumulate != nullptr || br == nullptr || br->isConditional())
+	{
+		return false;
+	}
+	BasicBlock* dest = br->getSuccessor(0);
+	ReturnInst* ret = dyn_cast<ReturnInst>(dest->getFirstNonPHI());
+	if (ret == nullptr)
+	{
+		return false;
+	}
+	site.mReturnBlock = dest;
+	if (ret->getReturnValue() == nullptr)
+	{
+		return call->use_empty();
+	}
+	PHINode* phi = dyn_cast<PHINode>(ret->getReturnValue());
+	return phi != nullptr && phi->getParent() == dest &&
+		phi->getIncomingValueForBlock(call->getParent()) == call && call->hasOneUse();
+}
+
+// Puts a new entry block ahead of the old one, which becomes the loop
+// header. The allocas move to the new entry so each iteration reuses
+// them instead of growing the stack.
+BasicBlock* TailRecursion::makeLoopHeader(Function& F)
+{
+	BasicBlock* header = &F.getEntryBlock();
+	BasicBlock* entry = BasicBlock::Create(F.getContext(), "entry", &F, header);
+	header->setName("tailrecurse");
+	BranchInst* br = BranchInst::Create(header, entry);
+
+	BasicBlock::iterator iter = header->begin();
+	while (iter != header->end())
+	{
+		Instruction* I = iter;
+		++iter;
+		AllocaInst* alloca = dyn_cast<AllocaInst>(I);
+		if (alloca != nullptr && isa<Constant>(alloca->getArraySize()))
+		{
+			alloca->moveBefore(br);
+		}
+	}
+	return header;
+}
+
+bool TailRecursion::runOnFunction(Function& F)
+{
+	if (F.isVarArg())
+	{
+		return false;
+	}
+
+	std::vector<TailCall> sites;
+	Instruction::BinaryOps accOp = Instruction::Add;
+	bool accumulate = false;
+	for (BasicBlock& block : F)
+	{
+		for (Instruction& I : block)
+		{
+			CallInst* call = dyn_cast<CallInst>(&I);
+			TailCall site;
+			if (call == nullptr || call->getCalledFunction() != &F ||
+				!matchTailCall(call, site))
+			{
+				continue;
+			}
+			// All accumulating calls must agree on the operation
+			if (site.mAccumulate != nullptr)
+			{
+				if (accumulate && site.mAccumulate->getOpcode() != accOp)
+				{
+					continue;
+				}
+				accOp = site.mAccumulate->getOpcode();
+				accumulate = true;
+			}
+			sites.push_back(site);
+		}
+	}
+
+	if (!sites.empty())
+	{
+		BasicBlock* header = makeLoopHeader(F);
+		BasicBlock* entry = &F.getEntryBlock();
+
+		std::vector<PHINode*> argPhis;
+		for (Argument& arg : F.getArgumentList())
+		{
+			PHINode* phi = PHINode::Create(arg.getType(), 2, arg.getName() + ".tr", header->begin());
+			arg.replaceAllUsesWith(phi);
+			phi->addIncoming(&arg, entry);
+			argPhis.push_back(phi);
+		}
+
+		PHINode* accPhi = nullptr;
+		if (accumulate)
+		{
+			Type* type = F.getReturnType();
+			accPhi = PHINode::Create(type, 2, "acc.tr", header->begin());
+			accPhi->addIncoming(ConstantInt::get(type, accOp == Instruction::Add ? 0 : 1), entry);
+		}
+
+		for (TailCall& site : sites)
+		{
+			CallInst* call = site.mCall;
+			BasicBlock* block = call->getParent();
+			for (unsigned i = 0; i < argPhis.size(); i++)
+			{
+				argPhis[i]->addIncoming(call->getArgOperand(i), block);
+			}
+			if (site.mAccumulate != nullptr)
+			{
+				accPhi->addIncoming(BinaryOperator::Create(accOp, accPhi, site.mOperand, "acc.next", call), block);
+			}
+			else if (accPhi != nullptr)
+			{
+				accPhi->addIncoming(accPhi, block);
+			}
+
+			if (site.mReturnBlock != nullptr)
+			{
+				site.mReturnBlock->removePredecessor(block);
+			}
+			block->getTerminator()->eraseFromParent();
+			if (site.mAccumulate != nullptr)
+			{
+				site.mAccumulate->eraseFromParent();
+			}
+			call->eraseFromParent();
+			BranchInst::Create(header, block);
+		}
+
+		// The remaining returns are the base cases
+		if (accPhi != nullptr)
+		{
+			for (BasicBlock& block : F)
+			{
+				ReturnInst* ret = dyn_cast<ReturnInst>(block.getTerminator());
+				if (ret != nullptr)
+				{
+					ret->setOperand(0, BinaryOperator::Create(accOp, accPhi,
+						ret->getReturnValue(), "acc.ret", ret));
+				}
+			}
+		}
+	}
+
+	if (gOptOptions.stats)
+	{
+		outs() << "TailRecursion: " << F.getName() << ": eliminated "
+			<< sites.size() << " tail calls\n";
+	}
+	return !sites.empty();
+}
+
+void TailRecursion::getAnalysisUsage(AnalysisUsage& Info) const
+{
+	// Adds a loop, so nothing is preserved
+}
+
+} // opt
+} // uscc
+
+char uscc::opt::TailRecursion::ID = 0;
@@ -49,8 +49,6 @@
 using namespace uscc::parse;
 using namespace llvm;
 
-extern size_t NUM_COLORS;
-
 CodeContext::CodeContext(StringTable& strings)
 : mGlobal(getGlobalContext())
 , mModule(nullptr)
@@ -78,8 +76,9 @@ Emitter::Emitter(Parser& parser) noexcept
 	parser.mRoot->emitIR(mContext);
 }
 
-void Emitter::optimize() noexcept
+void Emitter::optimize(const uscc::opt::OptOptions& options) noexcept
 {
+	uscc::opt::gOptOptions = options;
 	legacy::PassManager pm;
 	uscc::opt::registerOptPasses(pm);
 	pm.run(*mContext.mModule);
@@ -107,9 +106,12 @@ bool Emitter::verify() noexcept
 }
 
 // This function will take the bitcode emitted by uscc and convert it to assembly
-bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
+bool Emitter::writeAsm(const char *fileName, unsigned long numColors,
+					   const uscc::opt::RegAllocOptions& options,
+					   const uscc::opt::OptOptions& optOptions) noexcept
 {
 	NUM_COLORS = static_cast<size_t>(numColors);
+	uscc::opt::gRegAllocOptions = options;
 	Module* mod = mContext.mModule;
 	// This code is copied over from llc
 	InitializeNativeTarget();
@@ -126,14 +128,19 @@ bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
 	const char* argv[] = {
 		fileName,
 		"-optimize-regalloc=true",
-		"-regalloc=uscc"
+		options.allocator == uscc::opt::RegAllocOptions::AllocLinear ?
+			"-regalloc=uscc-linear" : "-regalloc=uscc"
 	};
 	cl::ParseCommandLineOptions(3, argv, "llvm system compiler\n");
 	
 	Triple TheTriple;
 	TheTriple.setTriple(sys::getDefaultTargetTriple());
 	
-	auto MCPU = sys::getHostCPUName();
+	std::string MCPU = optOptions.targetCPU;
+	if (MCPU.empty())
+	{
+		MCPU = sys::getHostCPUName();
+	}
 	
 	// Get the target specific parser.
 	std::string Error;
@@ -154,7 +161,8 @@ bool Emitter::writeAsm(const char *fileName, unsigned long numColors) noexcept
 	Options.MCOptions.AsmVerbose = true;
 	
 	std::unique_ptr<TargetMachine> target(
-										  TheTarget->createTargetMachine(TheTriple.getTriple(), MCPU, "",
+										  TheTarget->createTargetMachine(TheTriple.getTriple(), MCPU,
+																		 optOptions.targetFeatures,
 																		 Options, Reloc::Default,
 																		 CodeModel::Default, OLvl));
 	assert(target.get() && "Could not allocate target machine!");
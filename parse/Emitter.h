@@ -22,6 +22,8 @@
 
 #include "Types.h"
 #include "../opt/SSABuilder.h"
+#include "../opt/OptOptions.h"
+#include "../opt/RegAlloc.h"
 
 namespace uscc
 {
@@ -66,11 +68,13 @@ class Emitter
 {
 public:
 	Emitter(Parser& parser) noexcept;
-	void optimize() noexcept;
+	void optimize(const opt::OptOptions& options) noexcept;
 	void print() noexcept;
 	void writeBitcode(const char* fileName) noexcept;
 	bool verify() noexcept;
-	bool writeAsm(const char* fileName, unsigned long numColors) noexcept;
+	bool writeAsm(const char* fileName, unsigned long numColors,
+				  const opt::RegAllocOptions& options,
+				  const opt::OptOptions& optOptions) noexcept;
     void registerAnalysis();
     void doDCE();
     void doLiveness();
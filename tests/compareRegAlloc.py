@@ -0,0 +1,75 @@
+#---------------------------------------------------------
+# Copyright (c) 2014, Sanjay Madhav
+# All rights reserved.
+#
+# This file is distributed under the BSD license.
+# See LICENSE.TXT for details.
+#---------------------------------------------------------
+# Compares the register allocators on the test programs.
+# For each program that compiles, prints the allocation
+# time and the spill code each allocator produced, using
+# the JSON lines from --regalloc-stats.
+#
+# Usage: python compareRegAlloc.py [num-colors] [file.usc ...]
+#
+# num-colors (default 4) caps the registers of each class for both
+# allocators, so they are compared on the same register file.
+import glob
+import json
+import os
+import subprocess
+import sys
+
+uscc = "../bin/uscc"
+allocators = ["coloring", "linear"]
+
+def collect(fileName, allocator, num):
+	# Totals over every function in the file, or None if it did not compile
+	try:
+		output = subprocess.check_output([uscc, "--regalloc-stats", "--regalloc", allocator,
+			"--num-colors", "{}".format(num), "-s", fileName], stderr=subprocess.STDOUT)
+	except subprocess.CalledProcessError:
+		return None
+	totals = {"time": 0.0, "spills": 0, "reloads": 0, "spill_stores": 0}
+	for line in output.splitlines():
+		if not line.startswith("{"):
+			continue
+		stats = json.loads(line)
+		totals["time"] += sum(stats["time"].values())
+		for key in ["spills", "reloads", "spill_stores"]:
+			totals[key] += stats[key]
+	return totals
+
+def main():
+	if not os.path.isfile(uscc):
+		sys.exit("Can't run without uscc")
+	num = 4
+	files = sys.argv[1:]
+	if files and files[0].isdigit():
+		num = int(files[0])
+		files = files[1:]
+	if not files:
+		files = sorted(f for f in glob.glob("*.usc") if not f.endswith("e.usc"))
+
+	header = "{:<16}".format("file")
+	for a in allocators:
+		header += "{:>12}{:>8}{:>8}".format(a + " ms", "spills", "reloads")
+	print header
+	sums = dict((a, {"time": 0.0, "spills": 0, "reloads": 0}) for a in allocators)
+	for f in files:
+		results = [collect(f, a, num) for a in allocators]
+		if None in results:
+			continue
+		row = "{:<16}".format(f)
+		for a, r in zip(allocators, results):
+			row += "{:>12.3f}{:>8}{:>8}".format(r["time"] * 1000, r["spills"], r["reloads"])
+			for key in sums[a]:
+				sums[a][key] += r[key]
+		print row
+	row = "{:<16}".format("total")
+	for a in allocators:
+		row += "{:>12.3f}{:>8}{:>8}".format(sums[a]["time"] * 1000, sums[a]["spills"], sums[a]["reloads"])
+	print row
+
+if __name__ == "__main__":
+	main()
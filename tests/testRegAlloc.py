@@ -30,7 +30,7 @@ class AsmTests(unittest.TestCase):
 		expectFile.close()
 		# first compile to asm via uscc
 		try:
-			resultStr = subprocess.check_output([uscc, "--num-colors", "{}".format(num), "-s", fileName + ".usc"], stderr=subprocess.STDOUT)
+			resultStr = subprocess.check_output([uscc, "--regalloc-trace", "--num-colors", "{}".format(num), "-s", fileName + ".usc"], stderr=subprocess.STDOUT)
 			self.assertMultiLineEqual(expectedStr, resultStr)
 		except subprocess.CalledProcessError as e:
 			self.fail("\n" + e.output)
@@ -41,6 +41,31 @@ class AsmTests(unittest.TestCase):
 		# except subprocess.CalledProcessError as e:
 		# 	self.fail("\n" + e.output)
 		
+	def checkRun(self, fileName, num, splitMode="none"):
+		# read in expected
+		expectFile = open("expected/" + fileName + ".output", "r")
+		expectedStr = expectFile.read()
+		expectFile.close()
+		# compile optimized asm with few colors, so values get spilled/split
+		asmFile = fileName + ".{}.{}.s".format(num, splitMode)
+		exeFile = fileName + ".{}.{}.out".format(num, splitMode)
+		try:
+			subprocess.check_output([uscc, "-O", "-s", "--num-colors", "{}".format(num), "--split-mode", splitMode, "-o", asmFile, fileName + ".usc"], stderr=subprocess.STDOUT)
+			subprocess.check_output([gcc, asmFile, "-o", exeFile], stderr=subprocess.STDOUT)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+
+		# now run it and compare output
+		try:
+			resultStr = subprocess.check_output(["./" + exeFile], stderr=subprocess.STDOUT)
+			self.assertMultiLineEqual(expectedStr, resultStr)
+		except subprocess.CalledProcessError as e:
+			self.fail("\n" + e.output)
+		finally:
+			for f in [asmFile, exeFile]:
+				if os.path.isfile(f):
+					os.remove(f)
+		
 	def test_Asm_emit05(self):
 		self.checkEmit("emit05")
 		
@@ -85,5 +110,47 @@ class AsmTests(unittest.TestCase):
 		
 	def test_Asm_opt07(self):
 		self.checkEmit("opt07")
+		
+	def test_Run_emit09_2_none(self):
+		self.checkRun("emit09", 2, "none")
+		
+	def test_Run_emit11_2_none(self):
+		self.checkRun("emit11", 2, "none")
+		
+	def test_Run_emit12_3_none(self):
+		self.checkRun("emit12", 3, "none")
+		
+	def test_Run_quicksort_2_none(self):
+		self.checkRun("quicksort", 2, "none")
+		
+	def test_Run_016_3_none(self):
+		self.checkRun("test016", 3, "none")
+		
+	def test_Run_opt05_2_none(self):
+		self.checkRun("opt05", 2, "none")
+		
+	def test_Run_emit11_3_loop(self):
+		self.checkRun("emit11", 3, "loop")
+		
+	def test_Run_quicksort_3_loop(self):
+		self.checkRun("quicksort", 3, "loop")
+		
+	def test_Run_opt06_2_loop(self):
+		self.checkRun("opt06", 2, "loop")
+		
+	def test_Run_015_3_loop(self):
+		self.checkRun("test015", 3, "loop")
+		
+	def test_Run_emit12_3_region(self):
+		self.checkRun("emit12", 3, "region")
+		
+	def test_Run_quicksort_3_region(self):
+		self.checkRun("quicksort", 3, "region")
+		
+	def test_Run_opt07_2_region(self):
+		self.checkRun("opt07", 2, "region")
+		
+	def test_Run_016_2_region(self):
+		self.checkRun("test016", 2, "region")
 if __name__ == '__main__':
 	unittest.main(verbosity=2)
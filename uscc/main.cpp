@@ -58,15 +58,59 @@ int main(int argc, const char * argv[])
 			"Output LLVM IR to stdout.",
 			"-p", "--print-bc");
 	opt.add("", false, 0, 0,
-			"Enable optimization passes.",
+			"Enable optimization passes."
+			"\n\nWith -s, this also enables register coalescing and optimistic coloring in the register allocator.",
 			"-O");
+	opt.add("", false, 0, 0,
+			"With -O, print what each optimization pass changed in each function to stdout.",
+			"--opt-stats");
+	opt.add("4", false, 1, 0,
+			"With -O, specify how many iterations of a counted loop to unroll when its"
+			" trip count is not a small constant. A remainder loop runs the iterations"
+			" left over (1 disables partial unrolling).",
+			"-unroll-count", "--unroll-count");
+	opt.add("50", false, 1, 0,
+			"With -O, inline a call when the callee's size in instructions, less credit for"
+			" the call overhead and for constant or local array arguments, is at most this"
+			" number (0 disables inlining).",
+			"-inline-threshold", "--inline-threshold");
+	opt.add("", false, 1, 0,
+			"Specify the CPU to generate assembly for (the host CPU by default).",
+			"--target-cpu");
+	opt.add("", false, 1, 0,
+			"Specify target features to enable or disable, such as +avx2 or -sse4.1."
+			" With -O, +avx2 also lets the loop vectorizer use 256-bit vectors.",
+			"--target-features");
 	opt.add("", false, 0, 0,
 			"Generate an x86 assembly file from the LLVM IR generated by uscc."
 			" No optimization is performed."
 			"\n\nThis is provided for convenience in case LLVM developer tools (specifically llc)"
 			" are not installed. GCC or clang can turn this assembly file into an executable.",
 			"-s", "--assembly");
-	opt.add("4", false, 1, 0, "Specify number of colors for register graph coloring", "--num-colors");
+	opt.add("0", false, 1, 0,
+			"Specify the maximum number of colors for register graph coloring."
+			" Each register class uses as many colors as it has registers, up to this"
+			" number (0 for no limit). Linear scan is capped the same way.",
+			"--num-colors");
+	opt.add("coloring", false, 1, 0,
+			"Specify the register allocator: coloring (graph coloring) or linear"
+			" (linear scan, faster on very large functions).",
+			"--regalloc");
+	opt.add("none", false, 1, 0,
+			"Specify how the register allocator splits a live range before spilling it:"
+			" none, loop (spill around loops rather than inside them) or region"
+			" (keep each block's uses in a local range).",
+			"--split-mode");
+	opt.add("", false, 0, 0,
+			"Print the register allocator's simplify/select trace to stdout.",
+			"--regalloc-trace");
+	opt.add("", false, 0, 0,
+			"Print one line of JSON register allocator statistics per function to stdout.",
+			"--regalloc-stats");
+	opt.add("", false, 1, 0,
+			"Write each function's interference graph next to the assembly file,"
+			" as dot or json.",
+			"--regalloc-dump-graph");
 	opt.add("", false, 1, 0,
 			"Specify output file. This is ignored if -b and -s are specified simultaneously.",
 			"-o", "--output");
@@ -142,10 +186,21 @@ int main(int argc, const char * argv[])
             emit.doDCE();
         }
 
+		uscc::opt::OptOptions optOptions;
+		optOptions.stats = opt.isSet("--opt-stats");
+		unsigned long unrollCount = 4;
+		opt.get("--unroll-count")->getULong(unrollCount);
+		optOptions.unrollCount = static_cast<unsigned>(unrollCount);
+		unsigned long inlineThreshold = 50;
+		opt.get("--inline-threshold")->getULong(inlineThreshold);
+		optOptions.inlineThreshold = static_cast<unsigned>(inlineThreshold);
+		opt.get("--target-cpu")->getString(optOptions.targetCPU);
+		opt.get("--target-features")->getString(optOptions.targetFeatures);
+		
 		// Check if we should run optimization passes
 		if (opt.isSet("-O"))
 		{
-			emit.optimize();
+			emit.optimize(optOptions);
 		}
 		
 		bool shouldEmitBC = true;
@@ -218,9 +273,77 @@ int main(int argc, const char * argv[])
 				params->getString(asmFile);
 			}
 			ez::OptionGroup* params = opt.get("--num-colors");
-			unsigned long numColors = 4;
+			unsigned long numColors = 0;
 			params->getULong(numColors);
-			if (!emit.writeAsm(asmFile.c_str(), numColors))
+			uscc::opt::RegAllocOptions raOptions;
+			raOptions.optimize = opt.isSet("-O");
+			
+			std::string allocator;
+			opt.get("--regalloc")->getString(allocator);
+			if (allocator == "coloring")
+			{
+				raOptions.allocator = uscc::opt::RegAllocOptions::AllocColoring;
+			}
+			else if (allocator == "linear")
+			{
+				raOptions.allocator = uscc::opt::RegAllocOptions::AllocLinear;
+			}
+			else
+			{
+				std::cerr << "uscc: error: Unknown register allocator " << allocator << "." << std::endl;
+				return 1;
+			}
+			
+			std::string splitMode;
+			opt.get("--split-mode")->getString(splitMode);
+			if (splitMode == "none")
+			{
+				raOptions.splitMode = uscc::opt::RegAllocOptions::SplitNone;
+			}
+			else if (splitMode == "loop")
+			{
+				raOptions.splitMode = uscc::opt::RegAllocOptions::SplitLoop;
+			}
+			else if (splitMode == "region")
+			{
+				raOptions.splitMode = uscc::opt::RegAllocOptions::SplitRegion;
+			}
+			else
+			{
+				std::cerr << "uscc: error: Unknown split mode " << splitMode << "." << std::endl;
+				return 1;
+			}
+			
+			raOptions.trace = opt.isSet("--regalloc-trace");
+			raOptions.stats = opt.isSet("--regalloc-stats");
+			if (opt.isSet("--regalloc-dump-graph"))
+			{
+				std::string graphDump;
+				opt.get("--regalloc-dump-graph")->getString(graphDump);
+				if (graphDump == "dot")
+				{
+					raOptions.graphDump = uscc::opt::RegAllocOptions::DumpDot;
+				}
+				else if (graphDump == "json")
+				{
+					raOptions.graphDump = uscc::opt::RegAllocOptions::DumpJson;
+				}
+				else
+				{
+					std::cerr << "uscc: error: Unknown graph dump format " << graphDump << "." << std::endl;
+					return 1;
+				}
+				
+				// foo.s -> foo.<function>.dot
+				raOptions.graphDumpPrefix = asmFile;
+				size_t extLoc = asmFile.find_last_of(".");
+				if (extLoc != std::string::npos)
+				{
+					raOptions.graphDumpPrefix = asmFile.substr(0, extLoc);
+				}
+			}
+			
+			if (!emit.writeAsm(asmFile.c_str(), numColors, raOptions, optOptions))
 			{
 				std::cerr << "uscc: error: Unable to emit assembly. Compilation halted." << std::endl;
 			}